@@ -0,0 +1,60 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGNMENT 16 // Every block can be used with SSE loads
+
+/* Bump allocator for data that only lives until the next reset. The whole
+ * reserve is allocated once; blocks that large come straight from mmap, so
+ * pages that are never touched cost address space but no memory. Not
+ * thread safe, each thread that allocates needs its own arena. */
+typedef struct{
+        char* base;
+        size_t reserved;
+        size_t used;
+        size_t high_water; // Most bytes in use at once since arena_init
+}Arena;
+
+void arena_init(Arena* arena, const size_t reserve){
+        arena->base = (char*)malloc(reserve);
+        if(arena->base == NULL){
+                printf("ERROR: Could not reserve %zu bytes for an arena\n", reserve);
+                exit(1);
+        }
+        arena->reserved   = reserve;
+        arena->used       = 0;
+        arena->high_water = 0;
+}
+
+void* arena_alloc(Arena* arena, const size_t size){
+        size_t begin = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+        if(begin + size > arena->reserved){
+                printf("ERROR: Arena of %zu bytes is full, %zu more requested\n", arena->reserved, size);
+                exit(1);
+        }
+        arena->used = begin + size;
+        if(arena->used > arena->high_water) arena->high_water = arena->used;
+        return arena->base + begin;
+}
+
+// Bytes a single arena_alloc can still get
+size_t arena_available(const Arena* arena){
+        size_t begin = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+        return begin < arena->reserved ? arena->reserved - begin : 0;
+}
+
+// Everything allocated since the last reset becomes invalid
+void arena_reset(Arena* arena){
+        arena->used = 0;
+}
+
+void arena_free(Arena* arena){
+        free(arena->base);
+        arena->base = NULL;
+        arena->reserved = arena->used = 0;
+}
+
+#endif
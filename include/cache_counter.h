@@ -0,0 +1,64 @@
+#ifndef CACHE_COUNTER_H
+#define CACHE_COUNTER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+/* Cache misses of the calling thread, read from a perf_event_open counter.
+ * Where there is none (not Linux, no PMU in a VM, perf_event_paranoid too
+ * strict) it counts nanoseconds instead, so readings still compare with
+ * each other; cache_counter_unit says which one it is. */
+typedef struct{
+        int fd;
+        int hardware; // FALSE when counting nanoseconds
+        uint64_t start;
+}Cache_Counter;
+
+void cache_counter_init(Cache_Counter* counter){
+        counter->fd = -1;
+        counter->hardware = 0;
+        counter->start = 0;
+#if defined(__linux__)
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(attr);
+        attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        counter->fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        counter->hardware = counter->fd >= 0;
+#endif
+}
+
+const char* cache_counter_unit(const Cache_Counter* counter){
+        return counter->hardware ? "cache misses" : "ns";
+}
+
+uint64_t cache_counter_read(const Cache_Counter* counter){
+        if(counter->hardware){
+                uint64_t value = 0;
+                if(read(counter->fd, &value, sizeof(value)) != sizeof(value)) return 0;
+                return value;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec*1000000000u + now.tv_nsec;
+}
+
+void cache_counter_start(Cache_Counter* counter){
+        counter->start = cache_counter_read(counter);
+}
+
+// Misses, or nanoseconds, since cache_counter_start
+uint64_t cache_counter_stop(const Cache_Counter* counter){
+        return cache_counter_read(counter) - counter->start;
+}
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "common.h"
 #include "vec2.h"
+#include "vec2-array.h"
 #include "vec3.h"
 #include "vec4.h"
 #include "ivec2.h"
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c), Recep Aslantas.
+ *
+ * MIT License (MIT), http://opensource.org/licenses/MIT
+ * Full license can be found in the LICENSE file
+ */
+
+/*
+ AVX versions of the vec2-array.h kernels. Each one handles the largest
+ multiple of 8 elements and returns that count, the caller does the rest.
+ Columns do not need to be aligned.
+ */
+
+#ifndef cglm_vec2_array_avx_h
+#define cglm_vec2_array_avx_h
+#ifdef __AVX__
+
+#include "../../common.h"
+#include "../intrin.h"
+
+CGLM_INLINE
+size_t
+glm_vec2_array_scale_avx(const float *x, const float *y, float s,
+                         float *destx, float *desty, size_t n) {
+  __m256 xs;
+  size_t i;
+
+  xs = _mm256_set1_ps(s);
+  for (i = 0; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(destx + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), xs));
+    _mm256_storeu_ps(desty + i, _mm256_mul_ps(_mm256_loadu_ps(y + i), xs));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_muladds_avx(const float *x, const float *y, float s,
+                           float *destx, float *desty, size_t n) {
+  __m256 xs;
+  size_t i;
+
+  xs = _mm256_set1_ps(s);
+  for (i = 0; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(destx + i, glmm256_fmadd(_mm256_loadu_ps(x + i), xs,
+                                              _mm256_loadu_ps(destx + i)));
+    _mm256_storeu_ps(desty + i, glmm256_fmadd(_mm256_loadu_ps(y + i), xs,
+                                              _mm256_loadu_ps(desty + i)));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_normalize_avx(float *x, float *y, size_t n) {
+  __m256 x0, y0, len, inv, mask, eps, one;
+  size_t i;
+
+  eps = _mm256_set1_ps(GLM_FLT_EPSILON);
+  one = _mm256_set1_ps(1.0f);
+  for (i = 0; i + 8 <= n; i += 8) {
+    x0   = _mm256_loadu_ps(x + i);
+    y0   = _mm256_loadu_ps(y + i);
+    len  = _mm256_sqrt_ps(glmm256_fmadd(x0, x0, _mm256_mul_ps(y0, y0)));
+    mask = _mm256_cmp_ps(len, eps, _CMP_GE_OQ);  /* shorter vectors become zero */
+    inv  = _mm256_and_ps(mask, _mm256_div_ps(one, len));
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(x0, inv));
+    _mm256_storeu_ps(y + i, _mm256_mul_ps(y0, inv));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_clamp_length_avx(float *x, float *y, float maxlen, size_t n) {
+  __m256 x0, y0, scale, max, one;
+  size_t i;
+
+  max = _mm256_set1_ps(maxlen);
+  one = _mm256_set1_ps(1.0f);
+  for (i = 0; i + 8 <= n; i += 8) {
+    x0    = _mm256_loadu_ps(x + i);
+    y0    = _mm256_loadu_ps(y + i);
+    /* max / 0 is +inf, so zero vectors keep a scale of 1 */
+    scale = _mm256_min_ps(one, _mm256_div_ps(max, _mm256_sqrt_ps(
+                                  glmm256_fmadd(x0, x0, _mm256_mul_ps(y0, y0)))));
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(x0, scale));
+    _mm256_storeu_ps(y + i, _mm256_mul_ps(y0, scale));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_distance2_avx(const float *ax, const float *ay,
+                             const float *bx, const float *by,
+                             float *dest, size_t n) {
+  __m256 dx, dy;
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    dx = _mm256_sub_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+    dy = _mm256_sub_ps(_mm256_loadu_ps(ay + i), _mm256_loadu_ps(by + i));
+    _mm256_storeu_ps(dest + i, glmm256_fmadd(dx, dx, _mm256_mul_ps(dy, dy)));
+  }
+  return i;
+}
+
+#endif
+#endif /* cglm_vec2_array_avx_h */
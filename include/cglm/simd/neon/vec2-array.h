@@ -0,0 +1,123 @@
+/*
+ * Copyright (c), Recep Aslantas.
+ *
+ * MIT License (MIT), http://opensource.org/licenses/MIT
+ * Full license can be found in the LICENSE file
+ */
+
+/*
+ NEON versions of the vec2-array.h kernels. Each one handles the largest
+ multiple of 4 elements and returns that count, the caller does the rest.
+ */
+
+#ifndef cglm_vec2_array_neon_h
+#define cglm_vec2_array_neon_h
+#if defined(CGLM_NEON_FP)
+
+#include "../../common.h"
+#include "../intrin.h"
+
+/* 1 / sqrt(v), ARMv7 has no vector sqrt so it refines the estimate instead */
+static inline
+float32x4_t
+glmm_vec2_array_rsqrt_neon(float32x4_t v) {
+#if CGLM_ARM64
+  return vdivq_f32(vdupq_n_f32(1.0f), vsqrtq_f32(v));
+#else
+  float32x4_t r;
+  r = vrsqrteq_f32(v);
+  r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(v, r), r));
+  r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(v, r), r));
+  return r;
+#endif
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_scale_neon(const float *x, const float *y, float s,
+                          float *destx, float *desty, size_t n) {
+  float32x4_t vs;
+  size_t i;
+
+  vs = vdupq_n_f32(s);
+  for (i = 0; i + 4 <= n; i += 4) {
+    vst1q_f32(destx + i, vmulq_f32(vld1q_f32(x + i), vs));
+    vst1q_f32(desty + i, vmulq_f32(vld1q_f32(y + i), vs));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_muladds_neon(const float *x, const float *y, float s,
+                            float *destx, float *desty, size_t n) {
+  float32x4_t vs;
+  size_t i;
+
+  vs = vdupq_n_f32(s);
+  for (i = 0; i + 4 <= n; i += 4) {
+    vst1q_f32(destx + i, glmm_fmadd(vld1q_f32(x + i), vs, vld1q_f32(destx + i)));
+    vst1q_f32(desty + i, glmm_fmadd(vld1q_f32(y + i), vs, vld1q_f32(desty + i)));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_normalize_neon(float *x, float *y, size_t n) {
+  float32x4_t x0, y0, len2, inv, zero, eps2;
+  size_t i;
+
+  zero = vdupq_n_f32(0.0f);
+  eps2 = vdupq_n_f32(GLM_FLT_EPSILON * GLM_FLT_EPSILON);
+  for (i = 0; i + 4 <= n; i += 4) {
+    x0   = vld1q_f32(x + i);
+    y0   = vld1q_f32(y + i);
+    len2 = glmm_fmadd(x0, x0, vmulq_f32(y0, y0));
+    /* shorter vectors become zero */
+    inv  = vbslq_f32(vcgeq_f32(len2, eps2), glmm_vec2_array_rsqrt_neon(len2), zero);
+    vst1q_f32(x + i, vmulq_f32(x0, inv));
+    vst1q_f32(y + i, vmulq_f32(y0, inv));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_clamp_length_neon(float *x, float *y, float maxlen, size_t n) {
+  float32x4_t x0, y0, len2, scale, max, max2, one;
+  size_t i;
+
+  max  = vdupq_n_f32(maxlen);
+  max2 = vdupq_n_f32(maxlen * maxlen);
+  one  = vdupq_n_f32(1.0f);
+  for (i = 0; i + 4 <= n; i += 4) {
+    x0    = vld1q_f32(x + i);
+    y0    = vld1q_f32(y + i);
+    len2  = glmm_fmadd(x0, x0, vmulq_f32(y0, y0));
+    scale = vbslq_f32(vcgtq_f32(len2, max2),
+                      vmulq_f32(max, glmm_vec2_array_rsqrt_neon(len2)), one);
+    vst1q_f32(x + i, vmulq_f32(x0, scale));
+    vst1q_f32(y + i, vmulq_f32(y0, scale));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_distance2_neon(const float *ax, const float *ay,
+                              const float *bx, const float *by,
+                              float *dest, size_t n) {
+  float32x4_t dx, dy;
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    dx = vsubq_f32(vld1q_f32(ax + i), vld1q_f32(bx + i));
+    dy = vsubq_f32(vld1q_f32(ay + i), vld1q_f32(by + i));
+    vst1q_f32(dest + i, glmm_fmadd(dx, dx, vmulq_f32(dy, dy)));
+  }
+  return i;
+}
+
+#endif
+#endif /* cglm_vec2_array_neon_h */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c), Recep Aslantas.
+ *
+ * MIT License (MIT), http://opensource.org/licenses/MIT
+ * Full license can be found in the LICENSE file
+ */
+
+/*
+ SSE2 versions of the vec2-array.h kernels. Each one handles the largest
+ multiple of 4 elements and returns that count, the caller does the rest.
+ Columns do not need to be aligned.
+ */
+
+#ifndef cglm_vec2_array_sse2_h
+#define cglm_vec2_array_sse2_h
+#if defined( __SSE__ ) || defined( __SSE2__ )
+
+#include "../../common.h"
+#include "../intrin.h"
+
+CGLM_INLINE
+size_t
+glm_vec2_array_scale_sse2(const float *x, const float *y, float s,
+                          float *destx, float *desty, size_t n) {
+  __m128 xs;
+  size_t i;
+
+  xs = _mm_set1_ps(s);
+  for (i = 0; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(destx + i, _mm_mul_ps(_mm_loadu_ps(x + i), xs));
+    _mm_storeu_ps(desty + i, _mm_mul_ps(_mm_loadu_ps(y + i), xs));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_muladds_sse2(const float *x, const float *y, float s,
+                            float *destx, float *desty, size_t n) {
+  __m128 xs;
+  size_t i;
+
+  xs = _mm_set1_ps(s);
+  for (i = 0; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(destx + i, glmm_fmadd(_mm_loadu_ps(x + i), xs,
+                                        _mm_loadu_ps(destx + i)));
+    _mm_storeu_ps(desty + i, glmm_fmadd(_mm_loadu_ps(y + i), xs,
+                                        _mm_loadu_ps(desty + i)));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_normalize_sse2(float *x, float *y, size_t n) {
+  __m128 x0, y0, len, inv, mask, eps, one;
+  size_t i;
+
+  eps = _mm_set1_ps(GLM_FLT_EPSILON);
+  one = _mm_set1_ps(1.0f);
+  for (i = 0; i + 4 <= n; i += 4) {
+    x0   = _mm_loadu_ps(x + i);
+    y0   = _mm_loadu_ps(y + i);
+    len  = _mm_sqrt_ps(glmm_fmadd(x0, x0, _mm_mul_ps(y0, y0)));
+    mask = _mm_cmpge_ps(len, eps);  /* shorter vectors become zero */
+    inv  = _mm_and_ps(mask, _mm_div_ps(one, len));
+    _mm_storeu_ps(x + i, _mm_mul_ps(x0, inv));
+    _mm_storeu_ps(y + i, _mm_mul_ps(y0, inv));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_clamp_length_sse2(float *x, float *y, float maxlen, size_t n) {
+  __m128 x0, y0, scale, max, one;
+  size_t i;
+
+  max = _mm_set1_ps(maxlen);
+  one = _mm_set1_ps(1.0f);
+  for (i = 0; i + 4 <= n; i += 4) {
+    x0    = _mm_loadu_ps(x + i);
+    y0    = _mm_loadu_ps(y + i);
+    /* max / 0 is +inf, so zero vectors keep a scale of 1 */
+    scale = _mm_min_ps(one, _mm_div_ps(max, _mm_sqrt_ps(
+                                glmm_fmadd(x0, x0, _mm_mul_ps(y0, y0)))));
+    _mm_storeu_ps(x + i, _mm_mul_ps(x0, scale));
+    _mm_storeu_ps(y + i, _mm_mul_ps(y0, scale));
+  }
+  return i;
+}
+
+CGLM_INLINE
+size_t
+glm_vec2_array_distance2_sse2(const float *ax, const float *ay,
+                              const float *bx, const float *by,
+                              float *dest, size_t n) {
+  __m128 dx, dy;
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    dx = _mm_sub_ps(_mm_loadu_ps(ax + i), _mm_loadu_ps(bx + i));
+    dy = _mm_sub_ps(_mm_loadu_ps(ay + i), _mm_loadu_ps(by + i));
+    _mm_storeu_ps(dest + i, glmm_fmadd(dx, dx, _mm_mul_ps(dy, dy)));
+  }
+  return i;
+}
+
+#endif
+#endif /* cglm_vec2_array_sse2_h */
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c), Recep Aslantas.
+ *
+ * MIT License (MIT), http://opensource.org/licenses/MIT
+ * Full license can be found in the LICENSE file
+ */
+
+/*
+ Batch versions of the vec2 functions for structure of arrays data: vector
+ i is (x[i], y[i]). Destination columns may be the source columns.
+
+ The scalar tails count down the elements the SIMD kernel left, so once
+ inlined with a constant n gcc sees the trip count and does not warn with
+ -Waggressive-loop-optimizations.
+
+ Functions:
+   CGLM_INLINE void glm_vec2_array_scale(const float *x, const float *y,
+                                         float s, float *destx, float *desty,
+                                         size_t n);
+   CGLM_INLINE void glm_vec2_array_muladds(const float *x, const float *y,
+                                           float s, float *destx, float *desty,
+                                           size_t n);
+   CGLM_INLINE void glm_vec2_array_normalize(float *x, float *y, size_t n);
+   CGLM_INLINE void glm_vec2_array_clamp_length(float *x, float *y,
+                                                float maxlen, size_t n);
+   CGLM_INLINE void glm_vec2_array_distance2(const float *ax, const float *ay,
+                                             const float *bx, const float *by,
+                                             float *dest, size_t n);
+ */
+
+#ifndef cglm_vec2_array_h
+#define cglm_vec2_array_h
+
+#include "common.h"
+
+#ifdef CGLM_SSE_FP
+#  include "simd/sse2/vec2-array.h"
+#endif
+
+#ifdef CGLM_AVX_FP
+#  include "simd/avx/vec2-array.h"
+#endif
+
+#ifdef CGLM_NEON_FP
+#  include "simd/neon/vec2-array.h"
+#endif
+
+/*!
+ * @brief scale n vectors with scalar: dest = v * s
+ *
+ * @param[in]  x     x column
+ * @param[in]  y     y column
+ * @param[in]  s     scalar
+ * @param[out] destx destination x column
+ * @param[out] desty destination y column
+ * @param[in]  n     number of vectors
+ */
+CGLM_INLINE
+void
+glm_vec2_array_scale(const float *x, const float *y, float s,
+                     float *destx, float *desty, size_t n) {
+  size_t i = 0, rest;
+#if defined(__AVX__)
+  i = glm_vec2_array_scale_avx(x, y, s, destx, desty, n);
+#elif defined(__SSE__) || defined(__SSE2__)
+  i = glm_vec2_array_scale_sse2(x, y, s, destx, desty, n);
+#elif defined(CGLM_NEON_FP)
+  i = glm_vec2_array_scale_neon(x, y, s, destx, desty, n);
+#endif
+  for (rest = n - i; rest > 0; rest--, i++) {
+    destx[i] = x[i] * s;
+    desty[i] = y[i] * s;
+  }
+}
+
+/*!
+ * @brief add n scaled vectors to dest: dest += v * s
+ *
+ * @param[in]      x     x column
+ * @param[in]      y     y column
+ * @param[in]      s     scalar
+ * @param[in, out] destx destination x column
+ * @param[in, out] desty destination y column
+ * @param[in]      n     number of vectors
+ */
+CGLM_INLINE
+void
+glm_vec2_array_muladds(const float *x, const float *y, float s,
+                       float *destx, float *desty, size_t n) {
+  size_t i = 0, rest;
+#if defined(__AVX__)
+  i = glm_vec2_array_muladds_avx(x, y, s, destx, desty, n);
+#elif defined(__SSE__) || defined(__SSE2__)
+  i = glm_vec2_array_muladds_sse2(x, y, s, destx, desty, n);
+#elif defined(CGLM_NEON_FP)
+  i = glm_vec2_array_muladds_neon(x, y, s, destx, desty, n);
+#endif
+  for (rest = n - i; rest > 0; rest--, i++) {
+    destx[i] += x[i] * s;
+    desty[i] += y[i] * s;
+  }
+}
+
+/*!
+ * @brief normalize n vectors in place, vectors shorter than
+ *        GLM_FLT_EPSILON become zero like in glm_vec2_normalize
+ *
+ * @param[in, out] x x column
+ * @param[in, out] y y column
+ * @param[in]      n number of vectors
+ */
+CGLM_INLINE
+void
+glm_vec2_array_normalize(float *x, float *y, size_t n) {
+  size_t i = 0, rest;
+  float  norm;
+#if defined(__AVX__)
+  i = glm_vec2_array_normalize_avx(x, y, n);
+#elif defined(__SSE__) || defined(__SSE2__)
+  i = glm_vec2_array_normalize_sse2(x, y, n);
+#elif defined(CGLM_NEON_FP)
+  i = glm_vec2_array_normalize_neon(x, y, n);
+#endif
+  for (rest = n - i; rest > 0; rest--, i++) {
+    norm = sqrtf(x[i] * x[i] + y[i] * y[i]);
+    if (norm < GLM_FLT_EPSILON) {
+      x[i] = y[i] = 0.0f;
+      continue;
+    }
+    x[i] *= 1.0f / norm;
+    y[i] *= 1.0f / norm;
+  }
+}
+
+/*!
+ * @brief scale down, in place, the vectors longer than maxlen to maxlen
+ *
+ * @param[in, out] x      x column
+ * @param[in, out] y      y column
+ * @param[in]      maxlen maximum length
+ * @param[in]      n      number of vectors
+ */
+CGLM_INLINE
+void
+glm_vec2_array_clamp_length(float *x, float *y, float maxlen, size_t n) {
+  size_t i = 0, rest;
+  float  norm2, scale;
+#if defined(__AVX__)
+  i = glm_vec2_array_clamp_length_avx(x, y, maxlen, n);
+#elif defined(__SSE__) || defined(__SSE2__)
+  i = glm_vec2_array_clamp_length_sse2(x, y, maxlen, n);
+#elif defined(CGLM_NEON_FP)
+  i = glm_vec2_array_clamp_length_neon(x, y, maxlen, n);
+#endif
+  for (rest = n - i; rest > 0; rest--, i++) {
+    norm2 = x[i] * x[i] + y[i] * y[i];
+    if (norm2 <= maxlen * maxlen)
+      continue;
+    scale = maxlen / sqrtf(norm2);
+    x[i] *= scale;
+    y[i] *= scale;
+  }
+}
+
+/*!
+ * @brief squared distance between the vectors of two column pairs
+ *
+ * @param[in]  ax   x column of a
+ * @param[in]  ay   y column of a
+ * @param[in]  bx   x column of b
+ * @param[in]  by   y column of b
+ * @param[out] dest n squared distances
+ * @param[in]  n    number of vectors
+ */
+CGLM_INLINE
+void
+glm_vec2_array_distance2(const float *ax, const float *ay,
+                         const float *bx, const float *by,
+                         float *dest, size_t n) {
+  size_t i = 0, rest;
+  float  dx, dy;
+#if defined(__AVX__)
+  i = glm_vec2_array_distance2_avx(ax, ay, bx, by, dest, n);
+#elif defined(__SSE__) || defined(__SSE2__)
+  i = glm_vec2_array_distance2_sse2(ax, ay, bx, by, dest, n);
+#elif defined(CGLM_NEON_FP)
+  i = glm_vec2_array_distance2_neon(ax, ay, bx, by, dest, n);
+#endif
+  for (rest = n - i; rest > 0; rest--, i++) {
+    dx = ax[i] - bx[i];
+    dy = ay[i] - by[i];
+    dest[i] = dx * dx + dy * dy;
+  }
+}
+
+#endif /* cglm_vec2_array_h */
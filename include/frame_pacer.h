@@ -0,0 +1,121 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <SDL2/SDL_timer.h>
+#include <SDL2/SDL_video.h>
+#include <math.h>
+#include <stdio.h>
+
+// Last part of the wait is spent spinning, SDL_Delay can overshoot by about 1 ms
+#define FRAME_PACER_SPIN_MS 2
+
+typedef enum {
+        FRAME_PACE_SLEEP_SPIN,     // No vsync, sleep then spin up to the deadline
+        FRAME_PACE_VSYNC,          // SDL_GL_SetSwapInterval(1)
+        FRAME_PACE_ADAPTIVE_VSYNC, // SDL_GL_SetSwapInterval(-1), tears instead of halving the rate
+        FRAME_PACE_MODE_COUNT
+}Frame_Pace_Mode;
+
+typedef struct{
+        Frame_Pace_Mode mode;
+        Uint64 frequency;    // Performance counter ticks per second
+        Uint64 frame_ticks;  // Target frame length
+        Uint64 last_frame;
+        Uint64 deadline;
+
+        // Frame interval statistics since the last reset, Welford's running variance
+        unsigned int frames;
+        unsigned int missed;
+        double mean_ms;
+        double m2;
+        double worst_ms;
+}Frame_Pacer;
+
+const char* frame_pace_mode_name(const Frame_Pace_Mode mode){
+        switch(mode){
+                case FRAME_PACE_SLEEP_SPIN:     return "sleep+spin";
+                case FRAME_PACE_VSYNC:          return "vsync";
+                case FRAME_PACE_ADAPTIVE_VSYNC: return "adaptive vsync";
+                default:                        return "unknown";
+        }
+}
+
+void frame_pacer_reset_stats(Frame_Pacer* pacer){
+        pacer->frames   = 0;
+        pacer->missed   = 0;
+        pacer->mean_ms  = 0.0;
+        pacer->m2       = 0.0;
+        pacer->worst_ms = 0.0;
+}
+
+// Needs a current GL context. Returns the mode actually in use.
+Frame_Pace_Mode frame_pacer_set_mode(Frame_Pacer* pacer, Frame_Pace_Mode mode){
+        int interval = 0;
+        if(mode == FRAME_PACE_VSYNC) interval = 1;
+        if(mode == FRAME_PACE_ADAPTIVE_VSYNC) interval = -1;
+
+        if(SDL_GL_SetSwapInterval(interval) != 0){
+                if(mode == FRAME_PACE_ADAPTIVE_VSYNC){
+                        printf("Adaptive vsync not supported, using vsync\n");
+                        return frame_pacer_set_mode(pacer, FRAME_PACE_VSYNC);
+                }
+                if(mode == FRAME_PACE_VSYNC){
+                        printf("Vsync not supported, using sleep+spin\n");
+                        return frame_pacer_set_mode(pacer, FRAME_PACE_SLEEP_SPIN);
+                }
+        }
+        pacer->mode     = mode;
+        pacer->deadline = SDL_GetPerformanceCounter() + pacer->frame_ticks;
+        frame_pacer_reset_stats(pacer);
+        return mode;
+}
+
+void frame_pacer_init(Frame_Pacer* pacer, Frame_Pace_Mode mode, const unsigned int target_fps){
+        pacer->frequency   = SDL_GetPerformanceFrequency();
+        pacer->frame_ticks = pacer->frequency/target_fps;
+        pacer->last_frame  = SDL_GetPerformanceCounter();
+        frame_pacer_set_mode(pacer, mode);
+}
+
+/* Call once per frame. In sleep+spin mode this blocks until the frame
+ * deadline; with vsync the blocking already happened in SDL_GL_SwapWindow.
+ * Returns the time since the previous call, in seconds. */
+float frame_pacer_wait(Frame_Pacer* pacer){
+        if(pacer->mode == FRAME_PACE_SLEEP_SPIN){
+                Uint64 now = SDL_GetPerformanceCounter();
+                if(now < pacer->deadline){
+                        Uint64 remaining_ms = (pacer->deadline - now)*1000/pacer->frequency;
+                        if(remaining_ms > FRAME_PACER_SPIN_MS)
+                                SDL_Delay(remaining_ms - FRAME_PACER_SPIN_MS);
+                        while(SDL_GetPerformanceCounter() < pacer->deadline);
+                }
+                // Next deadline is relative to this one, so rounding does not drift.
+                // After a long stall start over instead of rushing frames to catch up.
+                pacer->deadline += pacer->frame_ticks;
+                now = SDL_GetPerformanceCounter();
+                if(now > pacer->deadline)
+                        pacer->deadline = now + pacer->frame_ticks;
+        }
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        Uint64 elapsed = now - pacer->last_frame;
+        pacer->last_frame = now;
+
+        double elapsed_ms = elapsed*1000.0/pacer->frequency;
+        pacer->frames++;
+        double delta = elapsed_ms - pacer->mean_ms;
+        pacer->mean_ms += delta/pacer->frames;
+        pacer->m2 += delta*(elapsed_ms - pacer->mean_ms);
+        if(elapsed_ms > pacer->worst_ms) pacer->worst_ms = elapsed_ms;
+        // Half a frame late means a refresh was skipped
+        if(elapsed > pacer->frame_ticks + pacer->frame_ticks/2) pacer->missed++;
+
+        return (float)(elapsed/(double)pacer->frequency);
+}
+
+double frame_pacer_stddev_ms(const Frame_Pacer* pacer){
+        if(pacer->frames < 2) return 0.0;
+        return sqrt(pacer->m2/(pacer->frames - 1));
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Growable memory whose pages live in a file instead of RAM and swap, so it
+ * can be larger than physical memory: the kernel writes cold pages back to
+ * the file and reads them in again on access. The file is unlinked as soon
+ * as it is open, so it goes away with the process. It is sparse, disk space
+ * is used as pages are written and running out of it raises SIGBUS. */
+typedef struct{
+        int fd;
+        void* base;
+        size_t size;
+}Mapped_File;
+
+void mapped_file_open(Mapped_File* file, const char* path){
+        file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if(file->fd < 0){
+                printf("ERROR: Could not create %s\n", path);
+                exit(1);
+        }
+        unlink(path);
+        file->base = NULL;
+        file->size = 0;
+}
+
+// Keeps the contents up to the old size, the rest reads as zeros. Returns the new base.
+void* mapped_file_resize(Mapped_File* file, const size_t size){
+        if(ftruncate(file->fd, size) != 0){
+                printf("ERROR: Could not grow mapped file to %zu bytes\n", size);
+                exit(1);
+        }
+        if(file->base != NULL) munmap(file->base, file->size);
+        file->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+        if(file->base == MAP_FAILED){
+                printf("ERROR: Could not map %zu bytes\n", size);
+                exit(1);
+        }
+        file->size = size;
+        // Bulk passes walk it front to back, so read ahead further and free pages behind
+        madvise(file->base, size, MADV_SEQUENTIAL);
+        return file->base;
+}
+
+// madvise on [offset, offset + length), widened to whole pages and clipped to the mapping
+void mapped_file_advise(const Mapped_File* file, const size_t offset, size_t length, const int advice){
+        if(offset >= file->size) return;
+        if(length > file->size - offset) length = file->size - offset;
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t begin = offset & ~(page - 1);
+        madvise((char*)file->base + begin, offset + length - begin, advice);
+}
+
+void mapped_file_close(Mapped_File* file){
+        if(file->base != NULL) munmap(file->base, file->size);
+        close(file->fd);
+        file->base = NULL;
+        file->size = 0;
+}
+
+#endif
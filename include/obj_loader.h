@@ -3,10 +3,37 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define TRUE 1
 #define FALSE 0
 
+#define OBJ_CACHE_MAGIC     0x4843424Fu  // "OBCH" read little endian
+#define OBJ_CACHE_VERSION   3
+#define OBJ_CACHE_EXTENSION ".meshcache"
+#define OBJ_CACHE_ALIGNMENT 4096         // Buffers start on a page boundary
+#define OBJ_PARALLEL_MIN_BYTES (4*1024*1024) // Smaller files are parsed on one thread
+#define OBJ_MAX_THREADS 64
+#define OBJ_STREAM_WINDOW (16*1024*1024) // Default bytes read at a time by obj_stream
+#define OBJ_STREAM_MIN_WINDOW (64*1024)  // A line must fit in one window
+#define OBJ_STREAM_MIN_BYTES (256*1024*1024) // obj_load_mesh streams larger files, see obj_stream_mesh
+#define OBJ_QUEUE_SIZE 8  // Finished meshes waiting for upload, a power of two
+#define OBJ_VERTEX_FLOATS 8   // Interleaved position xyz, texcoord uv, normal xyz
+#define OBJ_VERTEX_STRIDE (sizeof(float)*OBJ_VERTEX_FLOATS)
+
+#define OBJ_MESH_OPTIMIZE 1u  // obj_load_mesh flag: reorder for the post-transform cache
+#define OBJ_OPTIMIZER_CACHE_SIZE 32  // LRU size the Forsyth scores assume
+#define OBJ_ACMR_FIFO_SIZE 16        // FIFO size used to measure ACMR
+
 typedef struct Vertex{
         float x;
         float y;
@@ -16,48 +43,135 @@ typedef struct Vertex{
 typedef struct VertexArray{
         Vertex* verts;
         unsigned int size;
+        unsigned int capacity;
 }VertexArray;
 
+// View of one face inside a FaceArray, IDs are one based and 0 means the corner has none
 typedef struct{
-        unsigned int* vertex_ID;
+        const unsigned int* vertex_ID;
+        const unsigned int* texcoord_ID;
+        const unsigned int* normal_ID;
         unsigned int size;
 }Face;
 
+/* Compressed sparse rows: the corners of face i are
+ * [offset[i], offset[i+1]) in the three ID arrays. */
 typedef struct{
-        Face* array;
-        unsigned int size;
+        unsigned int* offset;      // size + 1 entries once a face was pushed
+        unsigned int* vertex_ID;
+        unsigned int* texcoord_ID;
+        unsigned int* normal_ID;
+        unsigned int size;         // Faces
+        unsigned int corners;
+        unsigned int face_capacity;
+        unsigned int corner_capacity;
 }FaceArray;
 
 typedef struct{
         VertexArray vertex;
         FaceArray   face;
+        VertexArray texcoord;  // u, v, w in x, y, z
+        VertexArray normal;
 } OBJ;
 
-void face_array_push(FaceArray* faceArray, const Face face){
-        if(faceArray->size == 0){
-                faceArray->array = (Face*)malloc(sizeof(Face));
-        }else{
-                faceArray->array = (Face*)realloc(faceArray->array, sizeof(Face)*(faceArray->size+1));
+// Triangulated, zero based, ready for glBufferData
+typedef struct{
+        float* vertices;           // OBJ_VERTEX_FLOATS per vertex
+        unsigned int vertex_count;
+        void* indices;             // uint16_t when index_size is 2, uint32_t when 4
+        unsigned int index_count;
+        unsigned int index_size;
+        void* mapping;             // Set when the buffers point into a mapped cache file
+        size_t mapping_size;
+        unsigned int flags;        // OBJ_MESH_OPTIMIZE when the triangles were reordered
+        float acmr;                // Vertex shader runs per triangle, see obj_acmr
+} Mesh_Data;
+
+// Negative index that was resolved against the counts of its own chunk only
+typedef struct{
+        unsigned int corner;
+        unsigned int attribute;  // 0 vertex, 1 texcoord, 2 normal
+} Obj_Fixup;
+
+typedef struct{
+        Obj_Fixup* array;
+        unsigned int size;
+        unsigned int capacity;
+} Obj_Fixup_List;
+
+/* Binary cache written next to the OBJ. The header is followed by the
+ * vertex buffer and the index buffer, each at a page aligned offset, exactly
+ * as they are handed to glBufferData. */
+typedef struct{
+        uint32_t magic;
+        uint32_t version;
+        int64_t  source_mtime;   // The cache is stale when either one changes
+        uint64_t source_size;
+        uint32_t vertex_count;
+        uint32_t vertex_stride;  // Bytes per vertex
+        uint32_t index_count;
+        uint32_t index_size;
+        uint64_t vertex_offset;
+        uint64_t index_offset;
+        uint32_t flags;
+        float    acmr;
+} Obj_Cache_Header;
+
+// Capacities double, so a mesh costs a handful of reallocs however big it is
+unsigned int obj_grow_capacity(unsigned int capacity, const unsigned int needed){
+        if(capacity == 0) capacity = 1024;
+        while(capacity < needed) capacity *= 2;
+        return capacity;
+}
+
+void* obj_realloc(void* array, const unsigned int count, const size_t element_size){
+        array = realloc(array, element_size*count);
+        if(array == NULL){
+                printf("Could not allocate %u elements of the OBJ\n", count);
+                exit(1);
         }
-        faceArray->array[faceArray->size] = face;
-        faceArray->size++;
+        return array;
 }
 
-void face_push(Face* face, unsigned int vertex_ID){
-        if(face->size == 0){
-                face->vertex_ID = (unsigned int*)malloc(sizeof(unsigned int));
-        }else{
-                face->vertex_ID = (unsigned int*)realloc(face->vertex_ID, sizeof(unsigned int)*(face->size+1));
+Face obj_face(const FaceArray* faces, const unsigned int i){
+        const unsigned int begin = faces->offset[i];
+        Face face = {&faces->vertex_ID[begin], &faces->texcoord_ID[begin], &faces->normal_ID[begin],
+                     faces->offset[i+1] - begin};
+        return face;
+}
+
+// Corners pushed since the last face_array_end belong to the next face
+void face_push(FaceArray* faces, unsigned int vertex_ID, unsigned int texcoord_ID, unsigned int normal_ID){
+        if(faces->corners == faces->corner_capacity){
+                unsigned int capacity = obj_grow_capacity(faces->corner_capacity, faces->corners + 1);
+                faces->vertex_ID   = (unsigned int*)obj_realloc(faces->vertex_ID, capacity, sizeof(unsigned int));
+                faces->texcoord_ID = (unsigned int*)obj_realloc(faces->texcoord_ID, capacity, sizeof(unsigned int));
+                faces->normal_ID   = (unsigned int*)obj_realloc(faces->normal_ID, capacity, sizeof(unsigned int));
+                faces->corner_capacity = capacity;
         }
-        face->vertex_ID[face->size] = vertex_ID;
-        face->size++;
+        faces->vertex_ID[faces->corners]   = vertex_ID;
+        faces->texcoord_ID[faces->corners] = texcoord_ID;
+        faces->normal_ID[faces->corners]   = normal_ID;
+        faces->corners++;
+}
+
+// Closes the face made of the corners pushed since the previous one, if any
+void face_array_end(FaceArray* faces){
+        const unsigned int begin = faces->size == 0 ? 0 : faces->offset[faces->size];
+        if(faces->corners == begin) return;
+        if(faces->size + 2 > faces->face_capacity){
+                faces->face_capacity = obj_grow_capacity(faces->face_capacity, faces->size + 2);
+                faces->offset = (unsigned int*)obj_realloc(faces->offset, faces->face_capacity, sizeof(unsigned int));
+        }
+        faces->offset[0] = 0;
+        faces->offset[faces->size + 1] = faces->corners;
+        faces->size++;
 }
 
 void vertexArray_Push(VertexArray* verArray, float x, float y, float z){
-        if(verArray->size == 0){
-                verArray->verts = (Vertex*)malloc(sizeof(Vertex));
-        }else{
-                verArray->verts = (Vertex*)realloc(verArray->verts, sizeof(Vertex)*(verArray->size+1));
+        if(verArray->size == verArray->capacity){
+                verArray->capacity = obj_grow_capacity(verArray->capacity, verArray->size + 1);
+                verArray->verts = (Vertex*)obj_realloc(verArray->verts, verArray->capacity, sizeof(Vertex));
         }
         verArray->verts[verArray->size].x = x;
         verArray->verts[verArray->size].y = y;
@@ -65,106 +179,1096 @@ void vertexArray_Push(VertexArray* verArray, float x, float y, float z){
         verArray->size++;
 }
 
+/* Number parsing for the mapped file, which is not NUL terminated.
+ * Each returns the first character it did not use, so no digits means the
+ * returned pointer is the one passed in. */
+const char* obj_parse_uint(const char* p, const char* end, unsigned int* out){
+        unsigned int value = 0;
+        while(p < end && *p >= '0' && *p <= '9'){
+                value = value*10 + (unsigned int)(*p - '0');
+                p++;
+        }
+        *out = value;
+        return p;
+}
+
+const char* obj_parse_int(const char* p, const char* end, int* out){
+        const char* start = p;
+        int negative = FALSE;
+        if(p < end && (*p == '-' || *p == '+')){
+                negative = *p == '-';
+                p++;
+        }
+        unsigned int value;
+        const char* digits = p;
+        p = obj_parse_uint(p, end, &value);
+        if(p == digits) return start;
+        *out = negative ? -(int)value : (int)value;
+        return p;
+}
+
+const char* obj_parse_float(const char* p, const char* end, float* out){
+        static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                       1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                       1e20, 1e21, 1e22};
+        const char* start = p;
+        int negative = FALSE;
+        if(p < end && (*p == '-' || *p == '+')){
+                negative = *p == '-';
+                p++;
+        }
+
+        // Up to 19 significant digits fit in the mantissa, the rest only move the exponent
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        int significant = 0;
+        int digits = 0;
+        while(p < end && *p >= '0' && *p <= '9'){
+                if(significant < 19){
+                        mantissa = mantissa*10 + (uint64_t)(*p - '0');
+                        if(mantissa != 0) significant++;
+                }else{
+                        exponent++;
+                }
+                digits++;
+                p++;
+        }
+        if(p < end && *p == '.'){
+                p++;
+                while(p < end && *p >= '0' && *p <= '9'){
+                        if(significant < 19){
+                                mantissa = mantissa*10 + (uint64_t)(*p - '0');
+                                if(mantissa != 0) significant++;
+                                exponent--;
+                        }
+                        digits++;
+                        p++;
+                }
+        }
+        if(digits == 0) return start;
+
+        if(p < end && (*p == 'e' || *p == 'E')){
+                int exp_value;
+                const char* after = obj_parse_int(p + 1, end, &exp_value);
+                if(after != p + 1){
+                        if(exp_value >  400) exp_value =  400;
+                        if(exp_value < -400) exp_value = -400;
+                        exponent += exp_value;
+                        p = after;
+                }
+        }
+
+        double value = (double)mantissa;
+        while(exponent > 22)  { value *= 1e22; exponent -= 22; }
+        while(exponent < -22) { value /= 1e22; exponent += 22; }
+        if(exponent >= 0) value *= pow10[exponent];
+        else              value /= pow10[-exponent];
+        *out = (float)(negative ? -value : value);
+        return p;
+}
+
+const char* obj_skip_blanks(const char* p, const char* end){
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        return p;
+}
+
+const char* obj_next_line(const char* p, const char* end){
+        while(p < end && *p != '\n') p++;
+        return p < end ? p + 1 : end;
+}
+
+/* OBJ indices are one based, negative ones count back from the last element
+ * read. When the range is a chunk of a larger file that count is only local,
+ * so the corner goes on the fixup list and the merge adds the elements of the
+ * earlier chunks (the stored value wraps if it pointed before this chunk). */
+unsigned int obj_resolve_index(const int index, const unsigned int count, FaceArray* faces,
+                               const unsigned int attribute, Obj_Fixup_List* fixups){
+        if(index >= 0) return (unsigned int)index;
+        if(fixups != NULL){
+                if(fixups->size == fixups->capacity){
+                        fixups->capacity = obj_grow_capacity(fixups->capacity, fixups->size + 1);
+                        fixups->array = (Obj_Fixup*)obj_realloc(fixups->array, fixups->capacity, sizeof(Obj_Fixup));
+                }
+                fixups->array[fixups->size].corner    = faces->corners;
+                fixups->array[fixups->size].attribute = attribute;
+                fixups->size++;
+        }
+        return count + 1 + (unsigned int)index;
+}
+
+/* Parses "v", "vt", "vn" and "f v", "f v/vt", "f v//vn", "f v/vt/vn" lines
+ * from [p, end) into objct, in one forward pass. Everything else is skipped.
+ * fixups is NULL unless the range is one chunk of a file. */
+void obj_parse_range(const char* p, const char* end, OBJ* objct, Obj_Fixup_List* fixups){
+        while(p < end){
+                p = obj_skip_blanks(p, end);
+                if(p == end) break;
+                const char ch = *p;
+                if(ch == 'v' && p + 1 < end){
+                        const char kind = p[1];
+                        float value[3] = {0.0f, 0.0f, 0.0f};
+                        p += (kind == 't' || kind == 'n') ? 2 : 1;
+                        if(kind == ' ' || kind == '\t' || kind == 't' || kind == 'n'){
+                                for(int i = 0; i < 3; i++){
+                                        p = obj_skip_blanks(p, end);
+                                        p = obj_parse_float(p, end, &value[i]);
+                                }
+                                if(kind == 't')      vertexArray_Push(&objct->texcoord, value[0], value[1], value[2]);
+                                else if(kind == 'n') vertexArray_Push(&objct->normal, value[0], value[1], value[2]);
+                                else                 vertexArray_Push(&objct->vertex, value[0], value[1], value[2]);
+                        }
+                }else if(ch == 'f' && p + 1 < end && (p[1] == ' ' || p[1] == '\t')){
+                        p++;
+                        while(1){
+                                int v, vt = 0, vn = 0;
+                                p = obj_skip_blanks(p, end);
+                                const char* corner = p;
+                                p = obj_parse_int(p, end, &v);
+                                if(p == corner) break;
+                                if(p < end && *p == '/'){
+                                        p = obj_parse_int(p + 1, end, &vt);
+                                        if(p < end && *p == '/')
+                                                p = obj_parse_int(p + 1, end, &vn);
+                                }
+                                face_push(&objct->face,
+                                          obj_resolve_index(v,  objct->vertex.size,   &objct->face, 0, fixups),
+                                          obj_resolve_index(vt, objct->texcoord.size, &objct->face, 1, fixups),
+                                          obj_resolve_index(vn, objct->normal.size,   &objct->face, 2, fixups));
+                        }
+                        face_array_end(&objct->face);
+                }
+                p = obj_next_line(p, end);
+        }
+}
+
+void free_obj(OBJ object){
+        FaceArray faces      = object.face;
+        VertexArray vertices = object.vertex;
+        free(faces.offset);
+        free(faces.vertex_ID);
+        free(faces.texcoord_ID);
+        free(faces.normal_ID);
+        free(vertices.verts);
+        free(object.texcoord.verts);
+        free(object.normal.verts);
+}
+
+/* Elements parsed from one window of a streamed file. Face IDs are one based
+ * and global, so vertex ID i is data.vertex.verts[i - 1 - first_vertex] when
+ * it belongs to this batch and an element of an earlier batch otherwise. */
+typedef struct{
+        OBJ data;
+        unsigned int first_vertex;    // Elements passed in earlier batches
+        unsigned int first_texcoord;
+        unsigned int first_normal;
+        unsigned int first_face;
+} Obj_Batch;
+
+// Return FALSE to stop the stream
+typedef int (*Obj_Batch_Callback)(const Obj_Batch* batch, void* user);
+
+typedef struct{
+        const char* begin;
+        const char* end;
+        OBJ object;
+        Obj_Fixup_List fixups;
+        // Elements of all earlier chunks, from the prefix sums
+        unsigned int vertex_base;
+        unsigned int texcoord_base;
+        unsigned int normal_base;
+        unsigned int face_base;
+        unsigned int corner_base;
+        OBJ* merged;
+} Obj_Chunk;
+
+void* obj_parse_chunk(void* data){
+        Obj_Chunk* chunk = (Obj_Chunk*)data;
+        obj_parse_range(chunk->begin, chunk->end, &chunk->object, &chunk->fixups);
+        return NULL;
+}
+
+void obj_copy_vertices(VertexArray* merged, const VertexArray* local, const unsigned int base){
+        if(local->size > 0)
+                memcpy(&merged->verts[base], local->verts, sizeof(Vertex)*local->size);
+}
+
+// Copies one chunk into its slot of the merged arrays and fixes its indices
+void* obj_merge_chunk(void* data){
+        Obj_Chunk* chunk = (Obj_Chunk*)data;
+        OBJ* merged = chunk->merged;
+        const OBJ* local = &chunk->object;
+        obj_copy_vertices(&merged->vertex,   &local->vertex,   chunk->vertex_base);
+        obj_copy_vertices(&merged->texcoord, &local->texcoord, chunk->texcoord_base);
+        obj_copy_vertices(&merged->normal,   &local->normal,   chunk->normal_base);
+
+        const unsigned int corners = local->face.corners;
+        unsigned int* vertex_ID   = &merged->face.vertex_ID[chunk->corner_base];
+        unsigned int* texcoord_ID = &merged->face.texcoord_ID[chunk->corner_base];
+        unsigned int* normal_ID   = &merged->face.normal_ID[chunk->corner_base];
+        if(corners > 0){
+                memcpy(vertex_ID,   local->face.vertex_ID,   sizeof(unsigned int)*corners);
+                memcpy(texcoord_ID, local->face.texcoord_ID, sizeof(unsigned int)*corners);
+                memcpy(normal_ID,   local->face.normal_ID,   sizeof(unsigned int)*corners);
+        }
+        for(unsigned int i = 0; i < local->face.size; i++)
+                merged->face.offset[chunk->face_base + i] = chunk->corner_base + local->face.offset[i];
+
+        for(unsigned int i = 0; i < chunk->fixups.size; i++){
+                const Obj_Fixup fixup = chunk->fixups.array[i];
+                if(fixup.attribute == 0)      vertex_ID[fixup.corner]   += chunk->vertex_base;
+                else if(fixup.attribute == 1) texcoord_ID[fixup.corner] += chunk->texcoord_base;
+                else                          normal_ID[fixup.corner]   += chunk->normal_base;
+        }
+        return NULL;
+}
+
+// Chunk 0 runs on the calling thread, and so does any chunk whose thread failed to start
+void obj_run_chunks(Obj_Chunk* chunks, const unsigned int threads, void* (*work)(void*)){
+        pthread_t workers[OBJ_MAX_THREADS];
+        int started[OBJ_MAX_THREADS];
+        for(unsigned int t = 1; t < threads; t++){
+                started[t] = pthread_create(&workers[t], NULL, work, &chunks[t]) == 0;
+                if(started[t] == FALSE) work(&chunks[t]);
+        }
+        work(&chunks[0]);
+        for(unsigned int t = 1; t < threads; t++){
+                if(started[t] == TRUE) pthread_join(workers[t], NULL);
+        }
+}
+
+/* Splits [data, data+size) into line aligned chunks parsed on their own
+ * threads, then sizes the final arrays from prefix sums of the chunk counts
+ * and lets every thread copy its chunk into place. */
+void obj_parse_parallel(const char* data, const size_t size, OBJ* object, unsigned int threads){
+        Obj_Chunk chunks[OBJ_MAX_THREADS];
+        if(threads < 1) threads = 1;
+        if(threads > OBJ_MAX_THREADS) threads = OBJ_MAX_THREADS;
+        const char* end = data + size;
+        const char* begin = data;
+        for(unsigned int t = 0; t < threads; t++){
+                const char* chunk_end = t + 1 == threads ? end : data + size/threads*(t + 1);
+                if(chunk_end < begin) chunk_end = begin;
+                chunk_end = obj_next_line(chunk_end, end);
+                memset(&chunks[t], 0, sizeof(Obj_Chunk));
+                chunks[t].begin  = begin;
+                chunks[t].end    = chunk_end;
+                chunks[t].merged = object;
+                begin = chunk_end;
+        }
+
+        obj_run_chunks(chunks, threads, obj_parse_chunk);
+
+        unsigned int vertices = 0, texcoords = 0, normals = 0, faces = 0, corners = 0;
+        for(unsigned int t = 0; t < threads; t++){
+                chunks[t].vertex_base   = vertices;
+                chunks[t].texcoord_base = texcoords;
+                chunks[t].normal_base   = normals;
+                chunks[t].face_base     = faces;
+                chunks[t].corner_base   = corners;
+                vertices  += chunks[t].object.vertex.size;
+                texcoords += chunks[t].object.texcoord.size;
+                normals   += chunks[t].object.normal.size;
+                faces     += chunks[t].object.face.size;
+                corners   += chunks[t].object.face.corners;
+        }
+
+        object->vertex.size   = object->vertex.capacity   = vertices;
+        object->texcoord.size = object->texcoord.capacity = texcoords;
+        object->normal.size   = object->normal.capacity   = normals;
+        object->vertex.verts   = (Vertex*)obj_realloc(NULL, vertices  > 0 ? vertices  : 1, sizeof(Vertex));
+        object->texcoord.verts = (Vertex*)obj_realloc(NULL, texcoords > 0 ? texcoords : 1, sizeof(Vertex));
+        object->normal.verts   = (Vertex*)obj_realloc(NULL, normals   > 0 ? normals   : 1, sizeof(Vertex));
+        object->face.size            = faces;
+        object->face.face_capacity   = faces + 1;
+        object->face.corners         = corners;
+        object->face.corner_capacity = corners > 0 ? corners : 1;
+        object->face.offset      = (unsigned int*)obj_realloc(NULL, faces + 1, sizeof(unsigned int));
+        object->face.vertex_ID   = (unsigned int*)obj_realloc(NULL, object->face.corner_capacity, sizeof(unsigned int));
+        object->face.texcoord_ID = (unsigned int*)obj_realloc(NULL, object->face.corner_capacity, sizeof(unsigned int));
+        object->face.normal_ID   = (unsigned int*)obj_realloc(NULL, object->face.corner_capacity, sizeof(unsigned int));
+        object->face.offset[faces] = corners;
+
+        obj_run_chunks(chunks, threads, obj_merge_chunk);
+
+        for(unsigned int t = 0; t < threads; t++){
+                free_obj(chunks[t].object);
+                free(chunks[t].fixups.array);
+        }
+}
+
 void read_obj(const char* filename, OBJ* objct){
-        FILE* file = fopen(filename, "r");
-        if(file == NULL){
+        int file = open(filename, O_RDONLY);
+        struct stat info;
+        if(file < 0 || fstat(file, &info) != 0){
                 printf("File %s could not be opened\n", filename);
                 exit(1);
         }
 
-        VertexArray vertices = {NULL, 0};
-        FaceArray faces = {NULL, 0};
-        
-        int ch;
-        while(1){
-                float x, y, z, w = 1;
-                unsigned int v;
-                Face face = {NULL, 0};
-                int end;
-                ch = fgetc(file);
-                if(ch == EOF)
-                        break;
-                switch(ch){
-                        case '#':
-                                while(ch != '\n')
-                                        ch = fgetc(file);
-                                break;
-                        case 'v':
-                                ch = fgetc(file);
-                                fseek(file, -1, SEEK_CUR);
-                                if(ch == 't' || ch == 'n')
+        OBJ object = {{NULL, 0, 0}, {NULL, NULL, NULL, NULL, 0, 0, 0, 0}, {NULL, 0, 0}, {NULL, 0, 0}};
+        if(info.st_size > 0){
+                const char* data = (const char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+                if(data == (const char*)MAP_FAILED){
+                        printf("File %s could not be mapped\n", filename);
+                        exit(1);
+                }
+                long threads = sysconf(_SC_NPROCESSORS_ONLN);
+                if(threads > OBJ_MAX_THREADS) threads = OBJ_MAX_THREADS;
+                if(threads > 1 && info.st_size >= OBJ_PARALLEL_MIN_BYTES)
+                        obj_parse_parallel(data, info.st_size, &object, (unsigned int)threads);
+                else
+                        obj_parse_range(data, data + info.st_size, &object, NULL);
+                munmap((void*)data, info.st_size);
+        }
+        close(file);
+
+        *objct = object;
+        printf("File \"%s\" successfull read.\n", filename);
+        fflush(stdout);
+}
+
+/* Reads filename window_size bytes at a time and hands the elements of each
+ * window to callback, reusing one batch for the whole file. Peak memory is
+ * the window plus the batch parsed from it, a few times window_size, however
+ * big the file is. Returns FALSE if callback stopped the stream. */
+int obj_stream(const char* filename, size_t window_size, Obj_Batch_Callback callback, void* user){
+        if(window_size < OBJ_STREAM_MIN_WINDOW) window_size = OBJ_STREAM_MIN_WINDOW;
+        int file = open(filename, O_RDONLY);
+        if(file < 0){
+                printf("File %s could not be opened\n", filename);
+                exit(1);
+        }
+        char* window = (char*)malloc(window_size);
+        if(window == NULL){
+                printf("Could not allocate a %zu byte stream window\n", window_size);
+                exit(1);
+        }
+
+        Obj_Batch batch;
+        memset(&batch, 0, sizeof(Obj_Batch));
+        Obj_Fixup_List fixups = {NULL, 0, 0};
+        size_t filled = 0;
+        int end_of_file = FALSE;
+        int running = TRUE;
+        while(running && (end_of_file == FALSE || filled > 0)){
+                while(end_of_file == FALSE && filled < window_size){
+                        ssize_t got = read(file, window + filled, window_size - filled);
+                        if(got < 0){
+                                printf("File %s could not be read\n", filename);
+                                exit(1);
+                        }
+                        if(got == 0) end_of_file = TRUE;
+                        filled += got;
+                }
+
+                // Parse whole lines only, the last partial one moves to the front of the window
+                size_t used = filled;
+                if(end_of_file == FALSE){
+                        while(used > 0 && window[used - 1] != '\n') used--;
+                        if(used == 0){
+                                printf("File %s has a line longer than %zu bytes\n", filename, window_size);
+                                exit(1);
+                        }
+                }
+
+                batch.data.vertex.size   = 0;
+                batch.data.texcoord.size = 0;
+                batch.data.normal.size   = 0;
+                batch.data.face.size     = 0;
+                batch.data.face.corners  = 0;
+                fixups.size = 0;
+                obj_parse_range(window, window + used, &batch.data, &fixups);
+
+                // Negative indices were counted from this batch only
+                for(unsigned int i = 0; i < fixups.size; i++){
+                        const Obj_Fixup fixup = fixups.array[i];
+                        if(fixup.attribute == 0)      batch.data.face.vertex_ID[fixup.corner]   += batch.first_vertex;
+                        else if(fixup.attribute == 1) batch.data.face.texcoord_ID[fixup.corner] += batch.first_texcoord;
+                        else                          batch.data.face.normal_ID[fixup.corner]   += batch.first_normal;
+                }
+
+                if(batch.data.vertex.size + batch.data.texcoord.size + batch.data.normal.size + batch.data.face.size > 0)
+                        running = callback(&batch, user);
+                batch.first_vertex   += batch.data.vertex.size;
+                batch.first_texcoord += batch.data.texcoord.size;
+                batch.first_normal   += batch.data.normal.size;
+                batch.first_face     += batch.data.face.size;
+
+                memmove(window, window + used, filled - used);
+                filled -= used;
+        }
+
+        free_obj(batch.data);
+        free(fixups.array);
+        free(window);
+        close(file);
+        return running;
+}
+
+// Open addressing table from (v, vt, vn) corners to mesh vertices
+typedef struct{
+        uint32_t* keys;      // 3 per slot, v == 0 marks an empty slot
+        uint32_t* values;
+        unsigned int mask;   // Slot count - 1, slot count is a power of two
+} Obj_Corner_Map;
+
+uint32_t obj_corner_hash(const uint32_t v, const uint32_t vt, const uint32_t vn){
+        uint32_t h = v*0x9E3779B1u ^ vt*0x85EBCA77u ^ vn*0xC2B2AE3Du;
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 12;
+        return h;
+}
+
+/* Index of the mesh vertex for this corner, appending it to vertices (the
+ * caller sized it for one vertex per corner) the first time it is seen. */
+uint32_t obj_corner_vertex(Obj_Corner_Map* map, const OBJ* object, const uint32_t v, const uint32_t vt,
+                           const uint32_t vn, float* vertices, unsigned int* vertex_count){
+        uint32_t slot = obj_corner_hash(v, vt, vn) & map->mask;
+        while(map->keys[slot*3] != 0){
+                const uint32_t* key = &map->keys[slot*3];
+                if(key[0] == v && key[1] == vt && key[2] == vn) return map->values[slot];
+                slot = (slot + 1) & map->mask;
+        }
+        map->keys[slot*3]     = v;
+        map->keys[slot*3 + 1] = vt;
+        map->keys[slot*3 + 2] = vn;
+        map->values[slot] = *vertex_count;
+
+        float* vertex = &vertices[*vertex_count*OBJ_VERTEX_FLOATS];
+        const Vertex position = object->vertex.verts[v - 1];
+        vertex[0] = position.x;
+        vertex[1] = position.y;
+        vertex[2] = position.z;
+        vertex[3] = vt != 0 ? object->texcoord.verts[vt - 1].x : 0.0f;
+        vertex[4] = vt != 0 ? object->texcoord.verts[vt - 1].y : 0.0f;
+        vertex[5] = vn != 0 ? object->normal.verts[vn - 1].x : 0.0f;
+        vertex[6] = vn != 0 ? object->normal.verts[vn - 1].y : 0.0f;
+        vertex[7] = vn != 0 ? object->normal.verts[vn - 1].z : 0.0f;
+        return (*vertex_count)++;
+}
+
+/* Average cache misses per triangle for a FIFO post-transform cache of
+ * OBJ_ACMR_FIFO_SIZE. 3 is the worst case, 0.5 the best for a regular grid. */
+float obj_acmr(const uint32_t* indices, const unsigned int index_count, const unsigned int vertex_count){
+        if(index_count < 3) return 0.0f;
+        // A vertex is still cached while fewer than FIFO_SIZE misses happened since it went in
+        uint32_t* inserted = (uint32_t*)obj_realloc(NULL, vertex_count > 0 ? vertex_count : 1, sizeof(uint32_t));
+        memset(inserted, 0xFF, sizeof(uint32_t)*vertex_count);
+        uint32_t misses = 0;
+        for(unsigned int i = 0; i < index_count; i++){
+                const uint32_t v = indices[i];
+                if(inserted[v] == UINT32_MAX || misses - inserted[v] >= OBJ_ACMR_FIFO_SIZE){
+                        inserted[v] = misses;
+                        misses++;
+                }
+        }
+        free(inserted);
+        return (float)misses/(index_count/3);
+}
+
+float obj_forsyth_vertex_score(const int cache_position, const unsigned int remaining){
+        if(remaining == 0) return -1.0f;
+        float score = 0.0f;
+        if(cache_position >= 0){
+                // The last triangle's vertices are scored lower so its neighbours are not always preferred
+                if(cache_position < 3) score = 0.75f;
+                else score = powf(1.0f - (float)(cache_position - 3)/(OBJ_OPTIMIZER_CACHE_SIZE - 3), 1.5f);
+        }
+        // Vertices with few triangles left are finished first, so they can leave the cache
+        return score + 2.0f/sqrtf((float)remaining);
+}
+
+/* Tom Forsyth's linear-speed vertex cache optimisation: triangles are emitted
+ * greedily by the score of their vertices in a simulated LRU cache. Then the
+ * vertices are renumbered in first-use order so fetches walk the buffer
+ * forward. indices and vertices are rewritten in place. Returns the new
+ * vertex count, less than vertex_count if some vertices are in no triangle. */
+unsigned int obj_optimize_mesh(uint32_t* indices, const unsigned int index_count, float* vertices, const unsigned int vertex_count){
+        const unsigned int triangle_count = index_count/3;
+        if(triangle_count == 0) return vertex_count;
+
+        // Triangles of each vertex, the first remaining[v] of them not emitted yet
+        unsigned int* adjacency_offset = (unsigned int*)calloc(vertex_count + 1, sizeof(unsigned int));
+        unsigned int* remaining = (unsigned int*)calloc(vertex_count, sizeof(unsigned int));
+        unsigned int* adjacency = (unsigned int*)obj_realloc(NULL, index_count, sizeof(unsigned int));
+        int* cache_position = (int*)obj_realloc(NULL, vertex_count, sizeof(int));
+        float* vertex_score = (float*)obj_realloc(NULL, vertex_count, sizeof(float));
+        float* triangle_score = (float*)obj_realloc(NULL, triangle_count, sizeof(float));
+        unsigned char* emitted = (unsigned char*)calloc(triangle_count, 1);
+        uint32_t* output = (uint32_t*)obj_realloc(NULL, index_count, sizeof(uint32_t));
+        if(adjacency_offset == NULL || remaining == NULL || emitted == NULL){
+                printf("Could not allocate mesh optimizer\n");
+                exit(1);
+        }
+
+        for(unsigned int i = 0; i < index_count; i++) remaining[indices[i]]++;
+        for(unsigned int v = 0; v < vertex_count; v++) adjacency_offset[v + 1] = adjacency_offset[v] + remaining[v];
+        memset(remaining, 0, sizeof(unsigned int)*vertex_count);
+        for(unsigned int i = 0; i < index_count; i++){
+                const uint32_t v = indices[i];
+                adjacency[adjacency_offset[v] + remaining[v]++] = i/3;
+        }
+        for(unsigned int v = 0; v < vertex_count; v++){
+                cache_position[v] = -1;
+                vertex_score[v] = obj_forsyth_vertex_score(-1, remaining[v]);
+        }
+        for(unsigned int t = 0; t < triangle_count; t++){
+                triangle_score[t] = vertex_score[indices[t*3]] + vertex_score[indices[t*3 + 1]] + vertex_score[indices[t*3 + 2]];
+        }
+
+        // Room for the cache plus the three vertices pushed in front of it
+        uint32_t cache[OBJ_OPTIMIZER_CACHE_SIZE + 3];
+        uint32_t new_cache[OBJ_OPTIMIZER_CACHE_SIZE + 3];
+        unsigned int cache_size = 0;
+        unsigned int cursor = 0;
+        long best = -1;
+        for(unsigned int out = 0; out < triangle_count; out++){
+                if(best < 0){
+                        // Nothing in the cache has triangles left, take the next one in file order
+                        while(emitted[cursor]) cursor++;
+                        best = cursor;
+                }
+                const uint32_t* triangle = &indices[best*3];
+                emitted[best] = TRUE;
+                output[out*3]     = triangle[0];
+                output[out*3 + 1] = triangle[1];
+                output[out*3 + 2] = triangle[2];
+
+                unsigned int new_size = 0;
+                for(int k = 0; k < 3; k++){
+                        const uint32_t v = triangle[k];
+                        unsigned int* list = &adjacency[adjacency_offset[v]];
+                        for(unsigned int j = 0; j < remaining[v]; j++){
+                                if(list[j] == (unsigned int)best){
+                                        list[j] = list[remaining[v] - 1];
+                                        remaining[v]--;
                                         break;
-                                fscanf(file, "%f %f %f %f", &x, &y ,&z, &w);
-                                //printf("v %.2f %.2f %.2f %.2f\n", x, y, z, w);
-                                vertexArray_Push(&vertices, x, y, z);
-                                break;
-                        case 'f':
-                                end = FALSE;
-                                while(end == FALSE){
-                                        while(fscanf(file, "%u", &v) == 1){
-                                                face_push(&face, v);
-                                                //printf("%u ", v);
-                                        }  // Parou no \n ou no '/'
-                                        fseek(file, -1, SEEK_CUR);
-                                        int aux = fgetc(file);
-                                        while(1){
-                                                if(aux == '\n'){
-                                                        end = TRUE;
-                                                        break;
-                                                }
-                                                if(aux == ' '){
-                                                        break;
-                                                }
-                                                aux = fgetc(file);
-                                        }
                                 }
-                                //fscanf(file, "%u", &v);
-                                //printf("%u ", v);
-                                //printf("\n");
-                                face_array_push(&faces, face);
-                                break;
-                        default:
-                                break;
-                }
-        }
-        if(0){
-        printf("\n");
-        printf("Output from function read_obj\n");
-        printf("STRUCTURES\n");
-        for(int i = 0; i < vertices.size; i++){
-                float x = vertices.verts[i].x;
-                float y = vertices.verts[i].y;
-                float z = vertices.verts[i].z;
-                printf("v %.2f %.2f %.2f\n", x, y, z);
-        }
-
-        printf("Faces %d\n", faces.size);
+                        }
+                        new_cache[new_size++] = v;
+                }
+                for(unsigned int c = 0; c < cache_size; c++){
+                        const uint32_t v = cache[c];
+                        if(v != triangle[0] && v != triangle[1] && v != triangle[2])
+                                new_cache[new_size++] = v;
+                }
+
+                // Rescore everything that was or is in the cache, and the triangles they touch
+                for(unsigned int c = 0; c < new_size; c++){
+                        const uint32_t v = new_cache[c];
+                        cache_position[v] = c < OBJ_OPTIMIZER_CACHE_SIZE ? (int)c : -1;
+                        vertex_score[v] = obj_forsyth_vertex_score(cache_position[v], remaining[v]);
+                }
+                best = -1;
+                float best_score = -1.0f;
+                for(unsigned int c = 0; c < new_size; c++){
+                        const uint32_t v = new_cache[c];
+                        const unsigned int* list = &adjacency[adjacency_offset[v]];
+                        for(unsigned int j = 0; j < remaining[v]; j++){
+                                const unsigned int t = list[j];
+                                triangle_score[t] = vertex_score[indices[t*3]] + vertex_score[indices[t*3 + 1]] + vertex_score[indices[t*3 + 2]];
+                                if(triangle_score[t] > best_score){
+                                        best_score = triangle_score[t];
+                                        best = t;
+                                }
+                        }
+                }
+                cache_size = new_size < OBJ_OPTIMIZER_CACHE_SIZE ? new_size : OBJ_OPTIMIZER_CACHE_SIZE;
+                memcpy(cache, new_cache, sizeof(uint32_t)*cache_size);
+        }
+
+        // Vertex fetch order: renumber by first use and move the vertices to match
+        uint32_t* remap = (uint32_t*)cache_position;
+        memset(remap, 0xFF, sizeof(uint32_t)*vertex_count);
+        uint32_t next = 0;
+        for(unsigned int i = 0; i < index_count; i++){
+                const uint32_t v = output[i];
+                if(remap[v] == UINT32_MAX) remap[v] = next++;
+                indices[i] = remap[v];
+        }
+        float* reordered = (float*)obj_realloc(NULL, vertex_count > 0 ? vertex_count : 1, OBJ_VERTEX_STRIDE);
+        for(unsigned int v = 0; v < vertex_count; v++){
+                if(remap[v] != UINT32_MAX)
+                        memcpy(&reordered[remap[v]*OBJ_VERTEX_FLOATS], &vertices[v*OBJ_VERTEX_FLOATS], OBJ_VERTEX_STRIDE);
+        }
+        // Vertices no triangle uses are dropped, the ones kept are at the front
+        memcpy(vertices, reordered, OBJ_VERTEX_STRIDE*next);
+
+        free(reordered);
+        free(adjacency_offset);
+        free(remaining);
+        free(adjacency);
+        free(cache_position);
+        free(vertex_score);
+        free(triangle_score);
+        free(emitted);
+        free(output);
+        return next;
+}
+
+/* Hands vertices and indices, both malloc'd, over to mesh: optimizes them
+ * when flags ask for it and narrows the indices to 16 bit when every vertex
+ * fits, 32 bit otherwise. */
+void obj_finish_mesh(Mesh_Data* mesh, float* vertices, unsigned int vertex_count, uint32_t* indices,
+                     const unsigned int index_count, const unsigned int flags){
+        mesh->flags = flags & OBJ_MESH_OPTIMIZE;
+        mesh->acmr  = obj_acmr(indices, index_count, vertex_count);
+        if(mesh->flags & OBJ_MESH_OPTIMIZE){
+                const float before = mesh->acmr;
+                vertex_count = obj_optimize_mesh(indices, index_count, vertices, vertex_count);
+                mesh->acmr = obj_acmr(indices, index_count, vertex_count);
+                printf("Mesh optimized, ACMR %.3f -> %.3f\n", before, mesh->acmr);
+        }
+
+        mesh->mapping      = NULL;
+        mesh->mapping_size = 0;
+        mesh->vertex_count = vertex_count;
+        mesh->index_count  = index_count;
+        mesh->vertices     = (float*)obj_realloc(vertices, vertex_count > 0 ? vertex_count : 1, OBJ_VERTEX_STRIDE);
+        if(vertex_count <= 65536){
+                // Into a buffer of their own, writing uint16_t through the uint32_t one breaks strict aliasing
+                uint16_t* indices16 = (uint16_t*)obj_realloc(NULL, index_count > 0 ? index_count : 1, sizeof(uint16_t));
+                for(unsigned int i = 0; i < index_count; i++)
+                        indices16[i] = (uint16_t)indices[i];
+                free(indices);
+                mesh->indices    = indices16;
+                mesh->index_size = 2;
+        }else{
+                mesh->indices    = obj_realloc(indices, index_count > 0 ? index_count : 1, sizeof(uint32_t));
+                mesh->index_size = 4;
+        }
+}
+
+/* Fans every face into triangles and gives each distinct (v, vt, vn) corner
+ * one interleaved vertex. With OBJ_MESH_OPTIMIZE the triangles and vertices
+ * are then reordered by obj_optimize_mesh. Indices are 16 bit when every
+ * vertex fits, 32 bit otherwise. Returns FALSE if a corner points past its
+ * array. */
+int obj_build_mesh(const OBJ* object, Mesh_Data* mesh, const unsigned int flags){
+        const FaceArray faces = object->face;
+
+        unsigned int index_count = 0;
         for(int i = 0; i < faces.size; i++){
-                printf("f ");
-                for(int j = 0; j < faces.array[i].size; j++){
-                        printf("%u ", faces.array[i].vertex_ID[j]);
+                const unsigned int corners = faces.offset[i+1] - faces.offset[i];
+                if(corners >= 3)
+                        index_count += (corners - 2)*3;
+        }
+        for(unsigned int i = 0; i < faces.corners; i++){
+                if(faces.vertex_ID[i] < 1 || faces.vertex_ID[i] > object->vertex.size ||
+                   faces.texcoord_ID[i] > object->texcoord.size || faces.normal_ID[i] > object->normal.size){
+                        printf("Corner %u uses %u/%u/%u, only %u/%u/%u available\n", i,
+                               faces.vertex_ID[i], faces.texcoord_ID[i], faces.normal_ID[i],
+                               object->vertex.size, object->texcoord.size, object->normal.size);
+                        return FALSE;
                 }
-                printf("\n");
         }
+
+        // At least twice as many slots as corners keeps the probes short
+        unsigned int slots = 1024;
+        while(slots < faces.corners*2) slots *= 2;
+        Obj_Corner_Map map;
+        map.mask   = slots - 1;
+        map.keys   = (uint32_t*)calloc((size_t)slots*3, sizeof(uint32_t));
+        map.values = (uint32_t*)malloc(sizeof(uint32_t)*slots);
+
+        float* vertices   = (float*)malloc(OBJ_VERTEX_STRIDE*(faces.corners > 0 ? faces.corners : 1));
+        uint32_t* indices = (uint32_t*)malloc(sizeof(uint32_t)*(index_count > 0 ? index_count : 1));
+        uint32_t* face_vertex = (uint32_t*)malloc(sizeof(uint32_t)*(faces.corners > 0 ? faces.corners : 1));
+        if(map.keys == NULL || map.values == NULL || vertices == NULL || indices == NULL || face_vertex == NULL){
+                printf("Could not allocate mesh\n");
+                exit(1);
         }
-        
-        objct->face   = faces;
-        objct->vertex = vertices;
 
-        fclose(file);
-        printf("File \"%s\" successfull read.\n", filename);
+        // Faces under 3 corners make no triangle, their corners get no vertex so none goes unused
+        unsigned int vertex_count = 0;
+        for(int i = 0; i < faces.size; i++){
+                if(faces.offset[i+1] - faces.offset[i] < 3) continue;
+                for(unsigned int c = faces.offset[i]; c < faces.offset[i+1]; c++){
+                        face_vertex[c] = obj_corner_vertex(&map, object, faces.vertex_ID[c], faces.texcoord_ID[c],
+                                                           faces.normal_ID[c], vertices, &vertex_count);
+                }
+        }
+        free(map.keys);
+        free(map.values);
+
+        unsigned int n = 0;
+        for(int i = 0; i < faces.size; i++){
+                const uint32_t* corner = &face_vertex[faces.offset[i]];
+                const unsigned int size = faces.offset[i+1] - faces.offset[i];
+                for(int j = 1; j + 1 < size; j++){
+                        indices[n++] = corner[0];
+                        indices[n++] = corner[j];
+                        indices[n++] = corner[j + 1];
+                }
+        }
+        free(face_vertex);
+
+        obj_finish_mesh(mesh, vertices, vertex_count, indices, index_count, flags);
+        return TRUE;
+}
+
+// Everything obj_stream_mesh keeps between batches
+typedef struct{
+        OBJ attributes;            // Every v, vt and vn so far, faces are not kept
+        Obj_Corner_Map map;
+        unsigned int slots;
+        float* vertices;
+        unsigned int vertex_count;
+        unsigned int vertex_capacity;
+        uint32_t* indices;
+        unsigned int index_count;
+        unsigned int index_capacity;
+        int valid;
+} Obj_Stream_Mesh;
+
+// Rehashes the map into slots slots, a power of two
+void obj_corner_map_resize(Obj_Corner_Map* map, const unsigned int old_slots, const unsigned int slots){
+        Obj_Corner_Map old = *map;
+        map->mask   = slots - 1;
+        map->keys   = (uint32_t*)calloc((size_t)slots*3, sizeof(uint32_t));
+        map->values = (uint32_t*)malloc(sizeof(uint32_t)*slots);
+        if(map->keys == NULL || map->values == NULL){
+                printf("Could not allocate mesh\n");
+                exit(1);
+        }
+        for(unsigned int s = 0; s < old_slots; s++){
+                const uint32_t* key = &old.keys[s*3];
+                if(key[0] == 0) continue;
+                uint32_t slot = obj_corner_hash(key[0], key[1], key[2]) & map->mask;
+                while(map->keys[slot*3] != 0) slot = (slot + 1) & map->mask;
+                memcpy(&map->keys[slot*3], key, sizeof(uint32_t)*3);
+                map->values[slot] = old.values[s];
+        }
+        free(old.keys);
+        free(old.values);
+}
+
+void obj_append_vertices(VertexArray* to, const VertexArray* from){
+        if(to->size + from->size > to->capacity){
+                to->capacity = obj_grow_capacity(to->capacity, to->size + from->size);
+                to->verts = (Vertex*)obj_realloc(to->verts, to->capacity, sizeof(Vertex));
+        }
+        obj_copy_vertices(to, from, to->size);
+        to->size += from->size;
+}
+
+/* obj_stream callback: keeps the batch's attributes and fans its faces
+ * straight into the mesh, with the same vertices and indices obj_build_mesh
+ * makes. A corner may only use attributes from its own or earlier batches. */
+int obj_stream_mesh_batch(const Obj_Batch* batch, void* user){
+        Obj_Stream_Mesh* builder = (Obj_Stream_Mesh*)user;
+        OBJ* attributes = &builder->attributes;
+        obj_append_vertices(&attributes->vertex, &batch->data.vertex);
+        obj_append_vertices(&attributes->texcoord, &batch->data.texcoord);
+        obj_append_vertices(&attributes->normal, &batch->data.normal);
+
+        const FaceArray* faces = &batch->data.face;
+        for(unsigned int i = 0; i < faces->size; i++){
+                const Face face = obj_face(faces, i);
+                if(face.size < 3) continue;
+                for(unsigned int c = 0; c < face.size; c++){
+                        if(face.vertex_ID[c] < 1 || face.vertex_ID[c] > attributes->vertex.size ||
+                           face.texcoord_ID[c] > attributes->texcoord.size || face.normal_ID[c] > attributes->normal.size){
+                                printf("Face %u uses %u/%u/%u, only %u/%u/%u available\n", batch->first_face + i,
+                                       face.vertex_ID[c], face.texcoord_ID[c], face.normal_ID[c],
+                                       attributes->vertex.size, attributes->texcoord.size, attributes->normal.size);
+                                builder->valid = FALSE;
+                                return FALSE;
+                        }
+                }
+
+                if(builder->vertex_count + face.size > builder->vertex_capacity){
+                        builder->vertex_capacity = obj_grow_capacity(builder->vertex_capacity, builder->vertex_count + face.size);
+                        builder->vertices = (float*)obj_realloc(builder->vertices, builder->vertex_capacity, OBJ_VERTEX_STRIDE);
+                }
+                if(builder->index_count + (face.size - 2)*3 > builder->index_capacity){
+                        builder->index_capacity = obj_grow_capacity(builder->index_capacity, builder->index_count + (face.size - 2)*3);
+                        builder->indices = (uint32_t*)obj_realloc(builder->indices, builder->index_capacity, sizeof(uint32_t));
+                }
+                // At least twice as many slots as vertices keeps the probes short
+                while((builder->vertex_count + face.size)*2 > builder->slots){
+                        obj_corner_map_resize(&builder->map, builder->slots, builder->slots*2);
+                        builder->slots *= 2;
+                }
+
+                uint32_t corner[3];
+                for(unsigned int c = 0; c < face.size; c++){
+                        corner[c < 2 ? c : 2] = obj_corner_vertex(&builder->map, attributes, face.vertex_ID[c], face.texcoord_ID[c],
+                                                                  face.normal_ID[c], builder->vertices, &builder->vertex_count);
+                        if(c < 2) continue;
+                        builder->indices[builder->index_count++] = corner[0];
+                        builder->indices[builder->index_count++] = corner[1];
+                        builder->indices[builder->index_count++] = corner[2];
+                        corner[1] = corner[2];
+                }
+        }
+        return TRUE;
+}
+
+/* obj_build_mesh for a file read with obj_stream. Only the attributes, the
+ * mesh so far and one window are in memory, the faces never are all at once.
+ * Single threaded, so slower than read_obj for files that fit. Returns FALSE
+ * if a corner points past its array. */
+int obj_stream_mesh(const char* filename, Mesh_Data* mesh, const unsigned int flags){
+        Obj_Stream_Mesh builder;
+        memset(&builder, 0, sizeof(Obj_Stream_Mesh));
+        builder.valid = TRUE;
+        builder.slots = 1024;
+        obj_corner_map_resize(&builder.map, 0, builder.slots);
+
+        obj_stream(filename, OBJ_STREAM_WINDOW, obj_stream_mesh_batch, &builder);
+        free_obj(builder.attributes);
+        free(builder.map.keys);
+        free(builder.map.values);
+        if(builder.valid == FALSE){
+                free(builder.vertices);
+                free(builder.indices);
+                return FALSE;
+        }
+        printf("File \"%s\" streamed.\n", filename);
         fflush(stdout);
+        obj_finish_mesh(mesh, builder.vertices, builder.vertex_count, builder.indices, builder.index_count, flags);
+        return TRUE;
 }
 
-void free_obj(OBJ object){
-        FaceArray faces      = object.face;
-        VertexArray vertices = object.vertex;
-        for(int i = 0; i < faces.size; i++){
-                free(faces.array[i].vertex_ID);
+void free_mesh_data(Mesh_Data* mesh){
+        if(mesh->mapping != NULL){
+                munmap(mesh->mapping, mesh->mapping_size);
+        }else{
+                free(mesh->vertices);
+                free(mesh->indices);
         }
-        free(vertices.verts);
-        free(faces.array);
+        mesh->mapping  = NULL;
+        mesh->vertices = NULL;
+        mesh->indices  = NULL;
+}
+
+uint64_t obj_cache_align(const uint64_t offset){
+        return (offset + OBJ_CACHE_ALIGNMENT - 1)/OBJ_CACHE_ALIGNMENT*OBJ_CACHE_ALIGNMENT;
+}
+
+// Maps the cache and points mesh into it. FALSE when missing, stale or damaged.
+int obj_cache_read(const char* cache_name, const struct stat* source, const unsigned int flags, Mesh_Data* mesh){
+        int file = open(cache_name, O_RDONLY);
+        if(file < 0) return FALSE;
+        struct stat info;
+        if(fstat(file, &info) != 0 || info.st_size < (off_t)sizeof(Obj_Cache_Header)){
+                close(file);
+                return FALSE;
+        }
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if(data == MAP_FAILED) return FALSE;
+
+        const Obj_Cache_Header* header = (const Obj_Cache_Header*)data;
+        const uint64_t vertex_bytes = (uint64_t)header->vertex_count*header->vertex_stride;
+        const uint64_t index_bytes  = (uint64_t)header->index_count*header->index_size;
+        if(header->magic != OBJ_CACHE_MAGIC || header->version != OBJ_CACHE_VERSION ||
+           header->source_mtime != (int64_t)source->st_mtime ||
+           header->source_size  != (uint64_t)source->st_size ||
+           header->flags != flags ||
+           header->vertex_stride != OBJ_VERTEX_STRIDE ||
+           (header->index_size != 2 && header->index_size != 4) ||
+           header->vertex_offset + vertex_bytes > (uint64_t)info.st_size ||
+           header->index_offset + index_bytes > (uint64_t)info.st_size){
+                munmap(data, info.st_size);
+                return FALSE;
+        }
+
+        mesh->vertices     = (float*)((char*)data + header->vertex_offset);
+        mesh->vertex_count = header->vertex_count;
+        mesh->indices      = (char*)data + header->index_offset;
+        mesh->index_count  = header->index_count;
+        mesh->index_size   = header->index_size;
+        mesh->mapping      = data;
+        mesh->mapping_size = info.st_size;
+        mesh->flags        = header->flags;
+        mesh->acmr         = header->acmr;
+        return TRUE;
+}
+
+// Written to a temporary name and renamed, so a reader never sees half a cache
+void obj_cache_write(const char* cache_name, const struct stat* source, const Mesh_Data* mesh){
+        Obj_Cache_Header header;
+        memset(&header, 0, sizeof(header));
+        header.magic         = OBJ_CACHE_MAGIC;
+        header.version       = OBJ_CACHE_VERSION;
+        header.source_mtime  = (int64_t)source->st_mtime;
+        header.source_size   = (uint64_t)source->st_size;
+        header.vertex_count  = mesh->vertex_count;
+        header.vertex_stride = OBJ_VERTEX_STRIDE;
+        header.index_count   = mesh->index_count;
+        header.index_size    = mesh->index_size;
+        header.vertex_offset = obj_cache_align(sizeof(header));
+        header.index_offset  = obj_cache_align(header.vertex_offset + (uint64_t)header.vertex_count*header.vertex_stride);
+        header.flags         = mesh->flags;
+        header.acmr          = mesh->acmr;
+
+        size_t name_size = strlen(cache_name) + 5;
+        char* temp_name = (char*)malloc(name_size);
+        snprintf(temp_name, name_size, "%s.tmp", cache_name);
+        FILE* file = fopen(temp_name, "wb");
+        if(file == NULL){
+                printf("Mesh cache %s could not be written\n", cache_name);
+                free(temp_name);
+                return;
+        }
+        static const char zeros[OBJ_CACHE_ALIGNMENT] = {0};
+        int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(zeros, 1, header.vertex_offset - sizeof(header), file) == header.vertex_offset - sizeof(header);
+        ok = ok && fwrite(mesh->vertices, header.vertex_stride, mesh->vertex_count, file) == mesh->vertex_count;
+        uint64_t vertex_end = header.vertex_offset + (uint64_t)header.vertex_count*header.vertex_stride;
+        ok = ok && fwrite(zeros, 1, header.index_offset - vertex_end, file) == header.index_offset - vertex_end;
+        ok = ok && fwrite(mesh->indices, mesh->index_size, mesh->index_count, file) == mesh->index_count;
+        ok = fclose(file) == 0 && ok;
+        if(ok == FALSE || rename(temp_name, cache_name) != 0){
+                printf("Mesh cache %s could not be written\n", cache_name);
+                remove(temp_name);
+        }
+        free(temp_name);
+}
+
+/* GPU ready mesh for filename. Uses filename.meshcache when it matches the
+ * source size and mtime and was built with the same flags, otherwise parses
+ * the OBJ, streaming it past OBJ_STREAM_MIN_BYTES, and writes the cache for
+ * next time. Returns FALSE if the OBJ has
+ * invalid faces. */
+int obj_load_mesh(const char* filename, Mesh_Data* mesh, const unsigned int flags){
+        struct stat source;
+        if(stat(filename, &source) != 0){
+                printf("File %s could not be opened\n", filename);
+                exit(1);
+        }
+
+        size_t name_size = strlen(filename) + strlen(OBJ_CACHE_EXTENSION) + 1;
+        char* cache_name = (char*)malloc(name_size);
+        snprintf(cache_name, name_size, "%s%s", filename, OBJ_CACHE_EXTENSION);
+
+        if(obj_cache_read(cache_name, &source, flags, mesh) == TRUE){
+                printf("File \"%s\" loaded from cache, ACMR %.3f.\n", filename, mesh->acmr);
+                fflush(stdout);
+                free(cache_name);
+                return TRUE;
+        }
+
+        int built;
+        if(source.st_size >= OBJ_STREAM_MIN_BYTES){
+                built = obj_stream_mesh(filename, mesh, flags);
+        }else{
+                OBJ object;
+                read_obj(filename, &object);
+                built = obj_build_mesh(&object, mesh, flags);
+                free_obj(object);
+        }
+        if(built == TRUE)
+                obj_cache_write(cache_name, &source, mesh);
+        free(cache_name);
+        return built;
+}
+
+typedef struct{
+        Mesh_Data mesh;
+        const char* filename;
+        int valid;              // FALSE if the OBJ had invalid faces, mesh is empty then
+} Obj_Loaded;
+
+/* Single producer, single consumer ring. Only the loader thread writes tail
+ * and only the render thread writes head, so neither side takes a lock. */
+typedef struct{
+        Obj_Loaded slot[OBJ_QUEUE_SIZE];
+        atomic_uint head;
+        atomic_uint tail;
+} Obj_Mesh_Queue;
+
+typedef struct{
+        char** filenames;
+        unsigned int count;
+        unsigned int flags;
+        Obj_Mesh_Queue queue;
+        atomic_int cancel;      // Set by obj_async_finish, checked between files
+        atomic_int done;        // Every file was pushed or the load was cancelled
+        pthread_t thread;
+        int started;
+} Obj_Async_Load;
+
+// Returns FALSE if the load was cancelled while the queue was full
+int obj_queue_push(Obj_Async_Load* load, const Obj_Loaded* loaded){
+        Obj_Mesh_Queue* queue = &load->queue;
+        const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        while(tail - atomic_load_explicit(&queue->head, memory_order_acquire) == OBJ_QUEUE_SIZE){
+                if(atomic_load_explicit(&load->cancel, memory_order_relaxed)) return FALSE;
+                sched_yield();
+        }
+        queue->slot[tail % OBJ_QUEUE_SIZE] = *loaded;
+        atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+        return TRUE;
 }
 
+int obj_queue_pop(Obj_Mesh_Queue* queue, Obj_Loaded* loaded){
+        const unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        if(head == atomic_load_explicit(&queue->tail, memory_order_acquire)) return FALSE;
+        *loaded = queue->slot[head % OBJ_QUEUE_SIZE];
+        atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+        return TRUE;
+}
+
+void* obj_async_worker(void* data){
+        Obj_Async_Load* load = (Obj_Async_Load*)data;
+        for(unsigned int i = 0; i < load->count; i++){
+                if(atomic_load_explicit(&load->cancel, memory_order_relaxed)) break;
+                Obj_Loaded loaded;
+                memset(&loaded, 0, sizeof(Obj_Loaded));
+                loaded.filename = load->filenames[i];
+                loaded.valid = obj_load_mesh(loaded.filename, &loaded.mesh, load->flags);
+                if(obj_queue_push(load, &loaded) == FALSE){
+                        free_mesh_data(&loaded.mesh);
+                        break;
+                }
+        }
+        atomic_store_explicit(&load->done, TRUE, memory_order_release);
+        return NULL;
+}
+
+/* Parses, builds and caches the meshes of filenames on a worker thread, in
+ * order. Poll with obj_async_poll from the GL thread. filenames must stay
+ * valid until obj_async_finish. */
+void obj_load_async(Obj_Async_Load* load, char** filenames, const unsigned int count, const unsigned int flags){
+        memset(load, 0, sizeof(Obj_Async_Load));
+        load->filenames = filenames;
+        load->count = count;
+        load->flags = flags;
+        atomic_init(&load->queue.head, 0);
+        atomic_init(&load->queue.tail, 0);
+        atomic_init(&load->cancel, FALSE);
+        atomic_init(&load->done, FALSE);
+        if(pthread_create(&load->thread, NULL, obj_async_worker, load) != 0){
+                printf("Could not start the OBJ loader thread\n");
+                exit(1);
+        }
+        load->started = TRUE;
+}
+
+// Next finished mesh, if any. The caller owns it and frees it with free_mesh_data.
+int obj_async_poll(Obj_Async_Load* load, Obj_Loaded* loaded){
+        return obj_queue_pop(&load->queue, loaded);
+}
+
+// TRUE once every mesh was loaded and taken from the queue
+int obj_async_idle(Obj_Async_Load* load){
+        if(load->started == FALSE) return TRUE;
+        if(atomic_load_explicit(&load->done, memory_order_acquire) == FALSE) return FALSE;
+        return atomic_load_explicit(&load->queue.head, memory_order_relaxed) ==
+               atomic_load_explicit(&load->queue.tail, memory_order_acquire);
+}
+
+// Stops after the file being parsed, joins the thread and frees what was not taken
+void obj_async_finish(Obj_Async_Load* load){
+        if(load->started == FALSE) return;
+        atomic_store_explicit(&load->cancel, TRUE, memory_order_relaxed);
+        pthread_join(load->thread, NULL);
+        Obj_Loaded loaded;
+        while(obj_queue_pop(&load->queue, &loaded)) free_mesh_data(&loaded.mesh);
+        load->started = FALSE;
+}
 
 #endif
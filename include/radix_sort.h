@@ -0,0 +1,113 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define RADIX_MAX_THREADS    16
+#define RADIX_MIN_PER_THREAD 65536 // Smaller slices are not worth starting a thread for
+
+// One thread's slice of a pass
+typedef struct{
+        const uint32_t* keys;
+        const uint32_t* values;
+        uint32_t* out_keys;
+        uint32_t* out_values;
+        size_t begin;
+        size_t end;
+        unsigned int shift;
+        size_t count[256]; // Histogram of the slice, then where its next key of each digit goes
+}Radix_Job;
+
+void* radix_histogram(void* data){
+        Radix_Job* job = (Radix_Job*)data;
+        memset(job->count, 0, sizeof(job->count));
+        for(size_t i = job->begin; i < job->end; i++)
+                job->count[(job->keys[i] >> job->shift) & 0xFF]++;
+        return NULL;
+}
+
+void* radix_scatter(void* data){
+        Radix_Job* job = (Radix_Job*)data;
+        for(size_t i = job->begin; i < job->end; i++){
+                const size_t to = job->count[(job->keys[i] >> job->shift) & 0xFF]++;
+                job->out_keys[to]   = job->keys[i];
+                job->out_values[to] = job->values[i];
+        }
+        return NULL;
+}
+
+// work on every job, the calling thread takes job 0
+void radix_run(void* (*work)(void*), Radix_Job* jobs, const unsigned int threads){
+        pthread_t handles[RADIX_MAX_THREADS];
+        int started[RADIX_MAX_THREADS];
+        for(unsigned int t = 1; t < threads; t++){
+                started[t] = pthread_create(&handles[t], NULL, work, &jobs[t]) == 0;
+                if(!started[t]) work(&jobs[t]);
+        }
+        work(&jobs[0]);
+        for(unsigned int t = 1; t < threads; t++){
+                if(started[t]) pthread_join(handles[t], NULL);
+        }
+}
+
+/* Stable sort of count key/value pairs by key, least significant byte
+ * first. Each pass splits the pairs into up to threads slices that count
+ * and scatter in parallel; slices write equal digits in slice order, so the
+ * sort stays stable. A byte every key shares costs a histogram but no
+ * scatter. The result ends in keys and values, the scratch arrays need
+ * count entries each. */
+void radix_sort_pairs(uint32_t* keys, uint32_t* values, uint32_t* scratch_keys, uint32_t* scratch_values,
+                      const size_t count, unsigned int threads){
+        if(threads > count/RADIX_MIN_PER_THREAD) threads = count/RADIX_MIN_PER_THREAD;
+        if(threads > RADIX_MAX_THREADS) threads = RADIX_MAX_THREADS;
+        if(threads < 1) threads = 1;
+
+        Radix_Job jobs[RADIX_MAX_THREADS];
+        uint32_t* from_keys   = keys;
+        uint32_t* from_values = values;
+        uint32_t* to_keys     = scratch_keys;
+        uint32_t* to_values   = scratch_values;
+        for(unsigned int shift = 0; shift < 32; shift += 8){
+                for(unsigned int t = 0; t < threads; t++){
+                        jobs[t].keys       = from_keys;
+                        jobs[t].values     = from_values;
+                        jobs[t].out_keys   = to_keys;
+                        jobs[t].out_values = to_values;
+                        jobs[t].begin      = count*t/threads;
+                        jobs[t].end        = count*(t + 1)/threads;
+                        jobs[t].shift      = shift;
+                }
+                radix_run(radix_histogram, jobs, threads);
+
+                // Exclusive prefix sum, digit major and slice minor
+                int shared = 0;
+                size_t total = 0;
+                for(unsigned int digit = 0; digit < 256; digit++){
+                        const size_t first = total;
+                        for(unsigned int t = 0; t < threads; t++){
+                                const size_t slice = jobs[t].count[digit];
+                                jobs[t].count[digit] = total;
+                                total += slice;
+                        }
+                        if(total - first == count) shared = 1;
+                }
+                if(shared) continue;
+                radix_run(radix_scatter, jobs, threads);
+
+                uint32_t* swap = from_keys;
+                from_keys = to_keys;
+                to_keys = swap;
+                swap = from_values;
+                from_values = to_values;
+                to_values = swap;
+        }
+        if(from_keys != keys){
+                memcpy(keys, from_keys, sizeof(uint32_t)*count);
+                memcpy(values, from_values, sizeof(uint32_t)*count);
+        }
+}
+
+#endif
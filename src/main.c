@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE // madvise and ftruncate are not part of -std=c99
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_events.h>
 #include <SDL2/SDL_keyboard.h>
@@ -5,6 +6,7 @@
 #include <SDL2/SDL_log.h>
 #include <SDL2/SDL_mouse.h>
 #include <SDL2/SDL_scancode.h>
+#include <SDL2/SDL_thread.h>
 #include <SDL2/SDL_timer.h>
 #include <SDL2/SDL_video.h>
 #include <glad/glad.h>
@@ -16,10 +18,22 @@
 #include <sys/types.h>
 #include <unistd.h> // for wait time
 #include <cglm/cglm.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
 
 #include "cglm/cam.h"
 #include "cglm/vec2.h"
 #include "cglm/vec3.h"
+#include "arena.h"
+#include "cache_counter.h"
+#include "frame_pacer.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
+#include "radix_sort.h"
 
 // Nuklear
 #define NK_INCLUDE_FIXED_TYPES
@@ -43,10 +57,38 @@
 #define TRUE  1
 #define FALSE 0
 #define TARGET_FPS 60
-#define FRAME_TARGET_TIME 1000/TARGET_FPS
 #define FOV 70
 #define SPEED_OF_C 1
 #define FORCE_MULTIPLIER 42
+#define LOD_THRESHOLD   100000  // Above this many particles draw the density grid
+#define LOD_GRID_WIDTH  320
+#define LOD_GRID_HEIGHT 240
+#define LOD_MAX_THREADS 16
+#define PARTICLE_RADIUS 0.05f   // Half size of the particle triangle, in world units
+#define TRAIL_FADE_STEP (1.0f/255.0f) // Taken off every trail channel per frame after the fade
+#define MAX_MESHES 16
+#define MAX_ARCHETYPES 16
+#define PARTICLE_TILE  61440    // Particles per system call, a multiple of every group size
+#define FUSED_CHUNK    120      // Particles a system takes through all its passes at once, fits in L1.
+                                // A multiple of every group size and of the SIMD width
+#define HEADLESS_STEPS 600      // Default length of a --headless run
+#define SORT_INTERVAL  120      // Steps between Morton sorts, each sorts the next archetype
+#define BENCHMARK_PARTICLES (8*1024*1024) // Default --benchmark size, well past the last level cache
+#define BENCHMARK_RUNS 10
+#define MESH_UPLOAD_BYTES (2*1024*1024) // Mesh bytes sent to the GPU per frame while loading
+#define FRAME_ARENA_SIZE  (256*1024*1024) // Least address space for per frame scratch, only touched pages use memory
+#define MAX_PARTICLES       2000000 // Default budgets, see Particle_Budget
+#define MAX_BARYON_QUARKS   300000
+#define MAX_MESON_QUARKS    1000000
+#define MAX_EXOTIC_QUARKS   100000  // Each of tetraquarks and pentaquarks
+#define MAX_PHOTONS         1000000
+#define BUDGET_THROTTLE_START 0.75f // Fill level where BUDGET_THROTTLE starts refusing pairs
+#define TURBULENCE_SHIFT    7       // Field is 1 << 7 = 128 cells per side
+#define TURBULENCE_SIZE     (1 << TURBULENCE_SHIFT)
+#define TURBULENCE_PERIOD   2.0f    // World units before the field repeats, the box is [-1, 1]
+#define TURBULENCE_RADIUS   1.5f    // Torus radius in noise space, larger gives smaller eddies
+#define TURBULENCE_STRENGTH 0.5f    // Force where the field is fastest
+#define TURBULENCE_DRIFT    0.02f   // World units per second the field slides by
 //#define SPEED_MULTIPLIER 1
 
 typedef enum {
@@ -70,7 +112,33 @@ typedef enum {
         GRAVITON
 }Particle_Type;
 
+typedef enum {
+        FAMILY_QUARK = 1,
+        FAMILY_LEPTON,
+        FAMILY_BOSON
+}Particle_Family;
+
+typedef enum {
+        COLOUR_NONE,
+        COLOUR_RED,
+        COLOUR_GREEN,
+        COLOUR_BLUE
+}Colour_Charge;
+
+/* A particle's kind in 16 bits. The family repeats what the type implies so
+ * filters like "all leptons" are one mask and compare. */
+typedef uint16_t Particle_Descriptor;
+#define DESCRIPTOR_TYPE_MASK    0x001F  // Particle_Type
+#define DESCRIPTOR_ANTI         0x0020
+#define DESCRIPTOR_COLOUR_SHIFT 6
+#define DESCRIPTOR_COLOUR_MASK  0x00C0  // Colour_Charge, the anticolour when DESCRIPTOR_ANTI is set
+#define DESCRIPTOR_ALIVE        0x0100
+#define DESCRIPTOR_FAMILY_SHIFT 9
+#define DESCRIPTOR_FAMILY_MASK  0x0600  // Particle_Family
+
 int rotate = TRUE;
+float zoom = 1.0f;
+int show_stats = FALSE;
 float rotate_speed = -1.0f/30; // frequency
 vec3 translation = {0.0f, 0.0f, 0.0f};
 
@@ -110,17 +178,107 @@ const char *fragmentShaderSource = "#version 100\n"
 "   gl_FragColor = vec4(ourColor.xyz*alpha, alpha);\n"
 "}\0";
 
+// Static scene geometry loaded from OBJ files
+const char *meshVertexShaderSource = "#version 100\n"
+"attribute vec3 aPos;\n"
+"attribute vec3 aNormal;\n"
+"uniform mat4 model;\n"
+"uniform mat4 view;\n"
+"uniform mat4 projection;\n"
+"varying float shade;\n"
+"void main()\n"
+"{\n"
+"   gl_Position = projection*view*model*vec4(aPos, 1.0);\n"
+"   float len = length(aNormal);\n"
+"   shade = len > 0.0 ? 0.6 + 0.4*abs(aNormal.z/len) : 1.0;\n"
+"}\0";
+
+const char *meshFragmentShaderSource = "#version 100\n"
+"precision mediump float;\n"
+"uniform vec4 ourColor;\n"
+"varying float shade;\n"
+"void main()\n"
+"{\n"
+"   gl_FragColor = vec4(ourColor.rgb*shade, ourColor.a);\n"
+"}\0";
+
+// Full-screen quad for the density LOD
+const char *densityVertexShaderSource = "#version 100\n"
+"attribute vec2 aPos;\n"
+"varying vec2 uv;\n"
+"void main()\n"
+"{\n"
+"   gl_Position = vec4(aPos, 0.0, 1.0);\n"
+"   uv = aPos*0.5 + 0.5;\n"
+"}\0";
+
+// RGB is the mean colour of the cell, A is log(1+count)/log(1+maxDensity)
+const char *densityFragmentShaderSource = "#version 100\n"
+"precision mediump float;\n"
+"varying vec2 uv;\n"
+"uniform sampler2D densityMap;\n"
+"uniform float maxDensity;\n"
+"uniform float exposure;\n"
+"void main()\n"
+"{\n"
+"   vec4 texel = texture2D(densityMap, uv);\n"
+"   float density = exp(texel.a*log(1.0 + maxDensity)) - 1.0;\n"
+"   float intensity = 1.0 - exp(-exposure*density);\n"
+"   gl_FragColor = vec4(texel.rgb*intensity, intensity);\n"
+"}\0";
+
+// Trails: fade the persistent framebuffer, then copy it to the window
+const char *fadeFragmentShaderSource = "#version 100\n"
+"precision mediump float;\n"
+"uniform vec4 colour;\n"
+"void main()\n"
+"{\n"
+"   gl_FragColor = colour;\n"
+"}\0";
+
+const char *blitFragmentShaderSource = "#version 100\n"
+"precision mediump float;\n"
+"varying vec2 uv;\n"
+"uniform sampler2D screenTexture;\n"
+"void main()\n"
+"{\n"
+"   gl_FragColor = texture2D(screenTexture, uv);\n"
+"}\0";
+
 unsigned int vertexShader;
 unsigned int fragmentShader;
 unsigned int shaderProgram;
 unsigned int VAO;
 unsigned int VBO;
 
-unsigned int VAO_faces;
-unsigned int VBO_faces;
-unsigned int EBO_faces;
+unsigned int meshProgram;
+int element_index_uint = FALSE; // GL_OES_element_index_uint
+unsigned int mesh_flags = OBJ_MESH_OPTIMIZE; // --no-optimize clears it
+
+unsigned int densityProgram;
+unsigned int densityTexture;
+unsigned int VBO_quad;
+unsigned int lod_threshold = LOD_THRESHOLD; // --lod-threshold
+unsigned int lod_threads = 1;
+unsigned char* lod_texels = NULL;
+int density_texture_ready = FALSE;
+
+unsigned int fadeProgram;
+unsigned int blitProgram;
+unsigned int trailFBO;
+unsigned int trailTexture;
+unsigned int trailDepth;
+int trails = FALSE;
+int trails_clear = TRUE;
+float trail_fade = 0.08f; // Fraction of the old frame removed every frame
+
+float* turbulence_x = NULL; // TURBULENCE_SIZE rows of TURBULENCE_SIZE, unit peak speed
+float* turbulence_y = NULL;
+int turbulence = FALSE;
+vec2 turbulence_offset = {0.0f, 0.0f};
 
 int last_frame_time = 0;
+Frame_Pacer pacer;
 int lastTime = 0;
 struct nk_context *ctx;
 
@@ -135,16 +293,134 @@ typedef struct Color_RGBA{
 typedef struct{
         vec2 position;
         vec2 velocity;
-        Particle_Type type;
-        int isAntiparticle;
+        Particle_Descriptor descriptor;
 }Particle;
 
+typedef enum {
+        BUDGET_DROP,     // Refuse new particles at the limit
+        BUDGET_MERGE,    // New particles take over the slots of old ones, round robin
+        BUDGET_THROTTLE, // Refuse a growing share of new particles past BUDGET_THROTTLE_START
+        BUDGET_POLICY_COUNT
+}Budget_Policy;
+
+/* Limit of one archetype. Arrays stay dense because removal moves the last
+ * particle into the hole, so the slots past size are the free list; they
+ * are reserved up to the limit once and reused without allocating. */
+typedef struct{
+        unsigned int limit;
+        unsigned int next_merge; // Next group overwritten by BUDGET_MERGE
+        // Pressure since the last print_stats, counted in groups
+        unsigned int dropped;
+        unsigned int merged;
+        unsigned int throttled;
+}Particle_Budget;
+
+// Which descriptors a filter_particles call keeps: (descriptor & mask) == value
+typedef struct{
+        Particle_Descriptor mask;
+        Particle_Descriptor value;
+}Descriptor_Filter;
+
+/* Identity that survives removals, which move particles between slots. The
+ * low bits pick a handle table entry holding the particle's current slot,
+ * the high bits are the entry's generation. The generation changes when the
+ * particle is removed, so an old handle stops matching once its entry is reused. */
+typedef uint64_t Particle_Handle;
+#define HANDLE_INDEX_BITS 32
+#define HANDLE_INDEX_MASK 0xFFFFFFFFu
+
 typedef struct{
-        Particle* particle;
+        uint32_t* slot;        // Slot of each live entry; for a free one the next free entry + 1
+        uint32_t* generation;
+        uint32_t used;         // Entries handed out at least once
+        uint32_t free;         // First free entry + 1, 0 when none
+}Handle_Table;
+
+// Value type used to move a single particle in and out of a Particle_Array
+// Storage is one column per field so bulk passes only touch what they need
+typedef struct{
+        float* position_x;
+        float* position_y;
+        float* velocity_x;
+        float* velocity_y;
+        Particle_Descriptor* descriptor;
+        Particle_Handle* handle;   // Handle of the particle in each slot
+        Handle_Table handles;
         unsigned int size;
         unsigned int capacity;
+        Mapped_File* store;        // One file per Particle_Column, NULL when the columns are on the heap
 }Particle_Array;
 
+typedef enum {
+        COLUMN_POSITION_X,
+        COLUMN_POSITION_Y,
+        COLUMN_VELOCITY_X,
+        COLUMN_VELOCITY_Y,
+        COLUMN_DESCRIPTOR,
+        COLUMN_HANDLE,
+        COLUMN_HANDLE_SLOT,       // Handle table, indexed by entry rather than slot
+        COLUMN_HANDLE_GENERATION,
+        PARTICLE_COLUMN_COUNT
+}Particle_Column;
+
+typedef struct{
+        unsigned int* index;
+        unsigned int size;
+        unsigned int capacity;
+}Index_List;
+
+// Force on each particle of a chunk, filled by its update before the batch passes
+typedef struct{
+        float* x;
+        float* y;
+        unsigned int capacity;
+}Force_Columns;
+
+/* Every particle of one species in one bound state, e.g. up quarks bound in
+ * baryons. The columns only hold that kind, in runs of group particles that
+ * are spawned and removed together, so a system never checks what it is
+ * looking at. A new kind of particle is one more archetype_register call. */
+typedef struct Archetype Archetype;
+// Updates the archetype's particles [begin, end), one tile at a time, see run_systems
+typedef void (*Archetype_System)(Archetype* archetype, unsigned int begin, unsigned int end, float delta_time);
+
+struct Archetype{
+        const char* name;
+        Particle_Type species;
+        unsigned int group;        // Particles per bound state, 1 for free particles
+        Particle_Array particles;
+        Particle_Budget budget;
+        Archetype_System system;
+        Index_List visible;        // This frame's cull_particles result
+        uint64_t cost;             // Last system run, in cache_counter units
+};
+
+// Last morton_sort, with the sorted archetype's system cost per particle around it
+typedef struct{
+        const char* name;
+        unsigned int groups;
+        double ms;
+        double before;
+        double after;
+        unsigned int sorts;        // Since the start
+}Sort_Report;
+
+// Uploaded once, drawn with a single glDrawElements
+typedef struct{
+        unsigned int VBO;
+        unsigned int EBO;
+        unsigned int index_count;
+        unsigned int index_type;  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+}Static_Mesh;
+
+// Visible region of the simulation plane, in particle coordinates
+typedef struct{
+        float min_x;
+        float max_x;
+        float min_y;
+        float max_y;
+}View_Bounds;
+
 vec3 camera_pos   = {0.0f, 0.0f,  7.0f};
 vec3 camera_front = {0.0f, 0.0f, -1.0f};
 vec3 camera_up    = {0.0f, 1.0f,  0.0f};
@@ -156,14 +432,45 @@ Color_RGBA color_green2 = {0.56f, 0.88f, 0.36f};
 Color_RGBA color_orange = {0.96f, 0.52f, 0.4f};
 Color_RGBA color_yellow = {0.93f, 0.85f, 0.39f};
 
-void draw_particle(const Particle particle, int ID){
-        vec3 position = {particle.position[0], particle.position[1]/1.33, 0.0f};
-        float verts[] = {-1.0f, -1.0f, 0.0f,
-                          0.0f, 1.0f, 0.0f,
-                          1.0f, -1.0f, 0.0f};
+Particle_Family particle_family(const Particle_Type type){
+        if(type <= QUARK_BOTTOM) return FAMILY_QUARK;
+        if(type <= NEUTRINO_TAU) return FAMILY_LEPTON;
+        return FAMILY_BOSON;
+}
+
+Particle_Descriptor make_descriptor(const Particle_Type type, const int isAntiparticle, const Colour_Charge colour){
+        return (Particle_Descriptor)(type |
+                                     (isAntiparticle == TRUE ? DESCRIPTOR_ANTI : 0) |
+                                     (colour << DESCRIPTOR_COLOUR_SHIFT) |
+                                     DESCRIPTOR_ALIVE |
+                                     (particle_family(type) << DESCRIPTOR_FAMILY_SHIFT));
+}
+
+Particle_Type descriptor_type(const Particle_Descriptor descriptor){
+        return (Particle_Type)(descriptor & DESCRIPTOR_TYPE_MASK);
+}
 
+int descriptor_is_anti(const Particle_Descriptor descriptor){
+        return (descriptor & DESCRIPTOR_ANTI) != 0;
+}
+
+Colour_Charge descriptor_colour(const Particle_Descriptor descriptor){
+        return (Colour_Charge)((descriptor & DESCRIPTOR_COLOUR_MASK) >> DESCRIPTOR_COLOUR_SHIFT);
+}
+
+int descriptor_alive(const Particle_Descriptor descriptor){
+        return (descriptor & DESCRIPTOR_ALIVE) != 0;
+}
+
+const Descriptor_Filter filter_quarks     = {DESCRIPTOR_FAMILY_MASK, FAMILY_QUARK << DESCRIPTOR_FAMILY_SHIFT};
+const Descriptor_Filter filter_antiquarks = {DESCRIPTOR_FAMILY_MASK | DESCRIPTOR_ANTI,
+                                             (FAMILY_QUARK << DESCRIPTOR_FAMILY_SHIFT) | DESCRIPTOR_ANTI};
+const Descriptor_Filter filter_leptons    = {DESCRIPTOR_FAMILY_MASK, FAMILY_LEPTON << DESCRIPTOR_FAMILY_SHIFT};
+const Descriptor_Filter filter_alive      = {DESCRIPTOR_ALIVE, DESCRIPTOR_ALIVE};
+
+Color_RGBA particle_color(const Particle_Descriptor descriptor){
         Color_RGBA color;
-        switch(particle.type){
+        switch(descriptor_type(descriptor)){
                 case QUARK_UP:
                 case QUARK_DOWN:
                 case QUARK_CHARM:
@@ -192,11 +499,48 @@ void draw_particle(const Particle particle, int ID){
                         break;
         }
 
-        if(particle.isAntiparticle == TRUE){
+        if(descriptor_is_anti(descriptor) == TRUE){
                 color.R = 1.0f - color.R;
                 color.G = 1.0f - color.G;
                 color.B = 1.0f - color.B;
         }
+        return color;
+}
+
+void camera_matrices(mat4 view, mat4 proj){
+        glm_mat4_identity(view);
+
+        // camera pos global
+        vec3 target_dir;
+        vec3 direction = {0.0f, 0.0f, -1.0f}; // mouse dir
+        glm_normalize_to(direction, camera_front); // mouse dir is normalized to camera front
+        glm_vec3_add(camera_pos, camera_front, target_dir);
+        glm_lookat(camera_pos, target_dir, camera_up, view);
+
+        glm_mat4_identity(proj);
+        glm_ortho(-1/zoom, 1/zoom, -1.0/1.33/zoom, 1.0/1.33/zoom, 0, 100, proj);
+}
+
+// Inverse of camera_matrices for the 2D case, grown by margin on every side
+View_Bounds get_view_bounds(const float margin){
+        const float half_width  = 1/zoom;
+        const float half_height = 1.0/1.33/zoom;
+        View_Bounds bounds;
+        bounds.min_x = camera_pos[0] - half_width - margin;
+        bounds.max_x = camera_pos[0] + half_width + margin;
+        // Particles are drawn at y/1.33
+        bounds.min_y = (camera_pos[1] - half_height - margin)*1.33;
+        bounds.max_y = (camera_pos[1] + half_height + margin)*1.33;
+        return bounds;
+}
+
+void draw_particle(const Particle particle, int ID){
+        vec3 position = {particle.position[0], particle.position[1]/1.33, 0.0f};
+        float verts[] = {-1.0f, -1.0f, 0.0f,
+                          0.0f, 1.0f, 0.0f,
+                          1.0f, -1.0f, 0.0f};
+
+        Color_RGBA color = particle_color(particle.descriptor);
 
         mat4 model;
         glm_mat4_identity(model);
@@ -210,19 +554,8 @@ void draw_particle(const Particle particle, int ID){
         glm_mat4_mul(world, model, model);
 
         mat4 view;   // Camera space
-        glm_mat4_identity(view);
-
-        // camera pos global
-        vec3 target_dir;
-        vec3 direction = {0.0f, 0.0f, -1.0f}; // mouse dir
-        glm_normalize_to(direction, camera_front); // mouse dir is normalized to camera front
-        glm_vec3_add(camera_pos, camera_front, target_dir);
-        glm_lookat(camera_pos, target_dir, camera_up, view);
-
-        /////////////////////////////////////////////////////////////////////
-        mat4 proj;  // Clip space
-        glm_mat4_identity(proj);
-        glm_ortho(-1,1,-1.0/1.33,1.0/1.33, 0, 100, proj);
+        mat4 proj;   // Clip space
+        camera_matrices(view, proj);
 
         int vertexColorLocation = glGetUniformLocation(shaderProgram, "ourColor");
         int transformLocation   = glGetUniformLocation(shaderProgram, "model");
@@ -248,23 +581,11 @@ void draw_particle(const Particle particle, int ID){
         glDrawArrays(GL_TRIANGLES, 0 , 3);
 }
 
-Particle_Array photons = {NULL, 0};
-Particle_Array mesons  = {NULL, 0};
-Particle_Array baryons = {NULL, 0};
-
-void init() {
-        srand(SDL_GetTicks());
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        //glEnable(GL_PROGRAM_POINT_SIZE);
-        //glEnable(GL_MULTISAMPLE);
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
+unsigned int create_shader_program(const char* vertexSource, const char* fragmentSource){
         int success;
         char infoLog[512];
         vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
+        glShaderSource(vertexShader, 1, &vertexSource, NULL);
         glCompileShader(vertexShader);
         glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
         if(!success){
@@ -275,7 +596,7 @@ void init() {
         }
 
         fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
+        glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
         glCompileShader(fragmentShader);
         glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
         if(!success){
@@ -284,26 +605,809 @@ void init() {
                 exit(1);
         }
 
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
-        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+        unsigned int program = glCreateProgram();
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        glBindAttribLocation(program, 0, "aPos"); // Every program feeds aPos from attribute 0
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
         if(!success) {
-                glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+                glGetProgramInfoLog(program, 512, NULL, infoLog);
                 printf("ERROR::SHADER::PROGRAM::COMPILATION_FAILED\n %s\n", infoLog);
                 exit(1);
         }
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
+        return program;
+}
+
+// Systems run in registration order
+Archetype archetypes[MAX_ARCHETYPES];
+unsigned int archetype_count = 0;
+Archetype* photons = NULL;
+Archetype* baryons = NULL;
+Archetype* mesons  = NULL;
+Archetype* tetraquarks = NULL; // Only registered with --exotics
+Archetype* pentaquarks = NULL;
+
+unsigned int particle_limit = MAX_PARTICLES; // All archetypes together
+Budget_Policy budget_policy = BUDGET_THROTTLE;
+unsigned int initial_baryons = 10;
+unsigned int initial_exotics = 0; // --exotics, tetraquarks and pentaquarks of each
+const char* store_directory = NULL; // --store, keeps the particle columns in files there
+
+unsigned int sort_interval = SORT_INTERVAL; // 0 turns Morton sorting off
+unsigned int sort_step = 0;
+unsigned int sort_next = 0;                 // Archetype the next sort takes
+Sort_Report sort_report = {0};
+Cache_Counter cache_counter = {-1};
+
+// --headless runs the systems for a fixed number of steps without a window
+int headless = FALSE;
+unsigned int headless_steps = HEADLESS_STEPS;
+unsigned int benchmark = 0; // --benchmark, particles to measure the update kernels with
+
+const char* budget_policy_name(const Budget_Policy policy){
+        switch(policy){
+                case BUDGET_DROP:     return "drop";
+                case BUDGET_MERGE:    return "merge";
+                case BUDGET_THROTTLE: return "throttle";
+                default:              return "unknown";
+        }
+}
+
+Archetype* archetype_find(const Particle_Type species, const unsigned int group){
+        for(unsigned int i = 0; i < archetype_count; i++){
+                if(archetypes[i].species == species && archetypes[i].group == group) return &archetypes[i];
+        }
+        return NULL;
+}
+
+// limit is in particles, group of them make one bound state
+Archetype* archetype_register(const char* name, const Particle_Type species, const unsigned int group,
+                              const unsigned int limit, const Archetype_System system){
+        if(archetype_find(species, group) != NULL){
+                printf("ERROR: Archetype %s registered twice\n", name);
+                exit(1);
+        }
+        if(archetype_count == MAX_ARCHETYPES){
+                printf("ERROR: More than %d archetypes, %s not registered\n", MAX_ARCHETYPES, name);
+                exit(1);
+        }
+        Archetype* archetype = &archetypes[archetype_count++];
+        memset(archetype, 0, sizeof(Archetype));
+        archetype->name         = name;
+        archetype->species      = species;
+        archetype->group        = group;
+        archetype->budget.limit = limit;
+        archetype->system       = system;
+        return archetype;
+}
+
+unsigned int particle_total(){
+        unsigned int total = 0;
+        for(unsigned int i = 0; i < archetype_count; i++) total += archetypes[i].particles.size;
+        return total;
+}
+
+Static_Mesh meshes[MAX_MESHES];
+unsigned int mesh_count = 0;
+// Meshes load on a worker thread and are uploaded a slice per frame
+Obj_Async_Load mesh_load;
+char* mesh_files[MAX_MESHES];
+unsigned int mesh_file_count = 0;
+Obj_Loaded mesh_upload;
+int mesh_uploading = FALSE;
+size_t mesh_upload_offset = 0; // Vertex bytes, then index bytes, already sent
+
+// Scratch for one frame, reset at the start of update(). Lists and columns
+// below point into it and are only valid until then.
+Arena frame_arena;
+Force_Columns forces = {0};
+
+unsigned int cull_visible = 0;
+unsigned int cull_culled  = 0;
+
+Particle particle_array_get(const Particle_Array* array, const unsigned int i){
+        Particle particle;
+        particle.position[0]    = array->position_x[i];
+        particle.position[1]    = array->position_y[i];
+        particle.velocity[0]    = array->velocity_x[i];
+        particle.velocity[1]    = array->velocity_y[i];
+        particle.descriptor     = array->descriptor[i];
+        return particle;
+}
+
+void particle_array_set(Particle_Array* array, const unsigned int i, const Particle particle){
+        array->position_x[i]     = particle.position[0];
+        array->position_y[i]     = particle.position[1];
+        array->velocity_x[i]     = particle.velocity[0];
+        array->velocity_y[i]     = particle.velocity[1];
+        array->descriptor[i]     = particle.descriptor;
+}
+
+unsigned int particle_handle_index(const Particle_Handle handle){
+        return handle & HANDLE_INDEX_MASK;
+}
+
+// Slot of the particle, or -1 if it was removed
+long particle_array_find(const Particle_Array* array, const Particle_Handle handle){
+        const unsigned int entry = particle_handle_index(handle);
+        if(entry >= array->handles.used) return -1;
+        if(array->handles.generation[entry] != handle >> HANDLE_INDEX_BITS) return -1;
+        return array->handles.slot[entry];
+}
+
+Particle_Handle handle_alloc(Particle_Array* array, const unsigned int slot){
+        Handle_Table* table = &array->handles;
+        uint32_t entry;
+        if(table->free != 0){
+                entry = table->free - 1;
+                table->free = table->slot[entry];
+        }else{
+                entry = table->used++;
+                table->generation[entry] = 0;
+        }
+        table->slot[entry] = slot;
+        array->handle[slot] = ((Particle_Handle)table->generation[entry] << HANDLE_INDEX_BITS) | entry;
+        return array->handle[slot];
+}
+
+void handle_free(Particle_Array* array, const Particle_Handle handle){
+        Handle_Table* table = &array->handles;
+        const uint32_t entry = particle_handle_index(handle);
+        table->generation[entry]++;
+        table->slot[entry] = table->free;
+        table->free = entry + 1;
+}
+
+// On the heap, or in the column's file when the array is mapped
+void* particle_column_resize(Particle_Array* array, const Particle_Column column, void* data, const size_t bytes){
+        if(array->store == NULL) return realloc(data, bytes);
+        return mapped_file_resize(&array->store[column], bytes);
+}
+
+void particle_array_reserve(Particle_Array* array, const unsigned int capacity){
+        if(capacity <= array->capacity) return;
+        const size_t count = capacity;
+        array->position_x = (float*)particle_column_resize(array, COLUMN_POSITION_X, array->position_x, sizeof(float)*count);
+        array->position_y = (float*)particle_column_resize(array, COLUMN_POSITION_Y, array->position_y, sizeof(float)*count);
+        array->velocity_x = (float*)particle_column_resize(array, COLUMN_VELOCITY_X, array->velocity_x, sizeof(float)*count);
+        array->velocity_y = (float*)particle_column_resize(array, COLUMN_VELOCITY_Y, array->velocity_y, sizeof(float)*count);
+        array->descriptor = (Particle_Descriptor*)particle_column_resize(array, COLUMN_DESCRIPTOR, array->descriptor,
+                                                                         sizeof(Particle_Descriptor)*count);
+        array->handle     = (Particle_Handle*)particle_column_resize(array, COLUMN_HANDLE, array->handle,
+                                                                     sizeof(Particle_Handle)*count);
+        // Entries are only created when every existing one is live, so there are never more than slots
+        array->handles.slot       = (uint32_t*)particle_column_resize(array, COLUMN_HANDLE_SLOT, array->handles.slot,
+                                                                      sizeof(uint32_t)*count);
+        array->handles.generation = (uint32_t*)particle_column_resize(array, COLUMN_HANDLE_GENERATION, array->handles.generation,
+                                                                      sizeof(uint32_t)*count);
+        if(array->position_x == NULL || array->position_y == NULL ||
+           array->velocity_x == NULL || array->velocity_y == NULL ||
+           array->descriptor == NULL || array->handle == NULL ||
+           array->handles.slot == NULL || array->handles.generation == NULL){
+                printf("ERROR: Could not grow particle array to %u\n", capacity);
+                exit(1);
+        }
+        array->capacity = capacity;
+}
+
+void particle_array_free(Particle_Array* array){
+        if(array->store != NULL){
+                for(int c = 0; c < PARTICLE_COLUMN_COUNT; c++) mapped_file_close(&array->store[c]);
+                free(array->store);
+        }else{
+                free(array->position_x);
+                free(array->position_y);
+                free(array->velocity_x);
+                free(array->velocity_y);
+                free(array->descriptor);
+                free(array->handle);
+                free(array->handles.slot);
+                free(array->handles.generation);
+        }
+        memset(array, 0, sizeof(Particle_Array));
+}
+
+/* Moves the columns into files under directory, for runs larger than
+ * memory. Has to happen before the array stores anything. */
+void particle_array_map(Particle_Array* array, const char* directory, const char* name){
+        if(array->capacity != 0){
+                printf("ERROR: %s already has storage, it cannot be mapped\n", name);
+                exit(1);
+        }
+        array->store = (Mapped_File*)malloc(sizeof(Mapped_File)*PARTICLE_COLUMN_COUNT);
+        if(array->store == NULL){
+                printf("ERROR: Could not allocate the column files of %s\n", name);
+                exit(1);
+        }
+        for(int c = 0; c < PARTICLE_COLUMN_COUNT; c++){
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/%s.%d", directory, name, c);
+                mapped_file_open(&array->store[c], path);
+        }
+}
+
+// madvise for slots [begin, end) of the per slot columns, heap arrays ignore it
+void particle_array_advise(const Particle_Array* array, const unsigned int begin, const unsigned int end, const int advice){
+        if(array->store == NULL || end <= begin) return;
+        const size_t size[] = {sizeof(float), sizeof(float), sizeof(float), sizeof(float),
+                               sizeof(Particle_Descriptor), sizeof(Particle_Handle)};
+        for(int c = COLUMN_POSITION_X; c <= COLUMN_HANDLE; c++)
+                mapped_file_advise(&array->store[c], size[c]*begin, size[c]*(end - begin), advice);
+}
+
+// Slots [begin, end) as an array of their own, for the column passes. Does not own the
+// columns and has no handle table, so it must not be pushed to or removed from.
+Particle_Array particle_array_tile(const Particle_Array* array, const unsigned int begin, const unsigned int end){
+        Particle_Array tile = {0};
+        tile.position_x = array->position_x + begin;
+        tile.position_y = array->position_y + begin;
+        tile.velocity_x = array->velocity_x + begin;
+        tile.velocity_y = array->velocity_y + begin;
+        tile.descriptor = array->descriptor + begin;
+        tile.handle     = array->handle + begin;
+        tile.size       = end - begin;
+        tile.capacity   = end - begin;
+        return tile;
+}
+
+void index_list_alloc(Index_List* list, const unsigned int capacity){
+        list->index = (unsigned int*)arena_alloc(&frame_arena, sizeof(unsigned int)*capacity);
+        list->size = 0;
+        list->capacity = capacity;
+}
+
+void force_columns_alloc(Force_Columns* columns, const unsigned int capacity){
+        columns->x = (float*)arena_alloc(&frame_arena, sizeof(float)*capacity);
+        columns->y = (float*)arena_alloc(&frame_arena, sizeof(float)*capacity);
+        columns->capacity = capacity;
+}
+
+/* Writes the indices of the particles whose descriptor passes filter to out,
+ * in order, and returns how many. Same branch free compaction as
+ * cull_particles, 8 descriptors per SSE2 compare; out needs 8 spare slots. */
+unsigned int filter_particles(const Particle_Array* array, const Descriptor_Filter filter, Index_List* out){
+        index_list_alloc(out, array->size + 8);
+        unsigned int* index = out->index;
+        unsigned int count = 0;
+        unsigned int i = 0;
+#if defined(__SSE2__)
+        const __m128i mask  = _mm_set1_epi16((short)filter.mask);
+        const __m128i value = _mm_set1_epi16((short)filter.value);
+        for(; i + 8 <= array->size; i += 8){
+                __m128i descriptors = _mm_loadu_si128((const __m128i*)&array->descriptor[i]);
+                // Two bits per 16 bit lane, keep the low one
+                int bits = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(descriptors, mask), value));
+                for(int lane = 0; lane < 8; lane++){
+                        index[count] = i + lane;
+                        count += (bits >> (lane*2)) & 1;
+                }
+        }
+#endif
+        for(; i < array->size; i++){
+                index[count] = i;
+                count += (array->descriptor[i] & filter.mask) == filter.value;
+        }
+        out->size = count;
+        return count;
+}
+
+/* How many particles filter_particles would keep, without writing their
+ * indices anywhere. */
+unsigned int count_matching(const Particle_Array* array, const Descriptor_Filter filter){
+        unsigned int count = 0;
+        unsigned int i = 0;
+#if defined(__SSE2__)
+        const __m128i mask  = _mm_set1_epi16((short)filter.mask);
+        const __m128i value = _mm_set1_epi16((short)filter.value);
+        for(; i + 8 <= array->size; i += 8){
+                __m128i descriptors = _mm_loadu_si128((const __m128i*)&array->descriptor[i]);
+                // Two bits per 16 bit lane, keep the low one
+                int bits = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(descriptors, mask), value)) & 0x5555;
+                for(; bits != 0; bits &= bits - 1) count++;
+        }
+#endif
+        for(; i < array->size; i++)
+                count += (array->descriptor[i] & filter.mask) == filter.value;
+        return count;
+}
+
+/* Writes the indices of the particles inside bounds to visible, in order.
+ * Every index is stored and the count only advances for the inside ones, so
+ * the loop has no data dependent branches; visible needs 4 spare slots. */
+unsigned int cull_particles(const Particle_Array* array, const View_Bounds bounds, Index_List* visible){
+        index_list_alloc(visible, array->size + 4);
+        unsigned int* out = visible->index;
+        unsigned int count = 0;
+        unsigned int i = 0;
+#if defined(__SSE2__)
+        const __m128 min_x = _mm_set1_ps(bounds.min_x);
+        const __m128 max_x = _mm_set1_ps(bounds.max_x);
+        const __m128 min_y = _mm_set1_ps(bounds.min_y);
+        const __m128 max_y = _mm_set1_ps(bounds.max_y);
+        for(; i + 4 <= array->size; i += 4){
+                __m128 x = _mm_loadu_ps(&array->position_x[i]);
+                __m128 y = _mm_loadu_ps(&array->position_y[i]);
+                __m128 inside_x = _mm_and_ps(_mm_cmpge_ps(x, min_x), _mm_cmple_ps(x, max_x));
+                __m128 inside_y = _mm_and_ps(_mm_cmpge_ps(y, min_y), _mm_cmple_ps(y, max_y));
+                int mask = _mm_movemask_ps(_mm_and_ps(inside_x, inside_y));
+                out[count] = i;     count += mask & 1;
+                out[count] = i + 1; count += (mask >> 1) & 1;
+                out[count] = i + 2; count += (mask >> 2) & 1;
+                out[count] = i + 3; count += (mask >> 3) & 1;
+        }
+#endif
+        for(; i < array->size; i++){
+                const float x = array->position_x[i];
+                const float y = array->position_y[i];
+                out[count] = i;
+                count += (x >= bounds.min_x) & (x <= bounds.max_x) & (y >= bounds.min_y) & (y <= bounds.max_y);
+        }
+        visible->size = count;
+        return count;
+}
+
+/* Density LOD
+ * Past lod_threshold particles the individual triangles are just noise, so the
+ * particles are binned into a LOD_GRID_WIDTH x LOD_GRID_HEIGHT grid on the CPU
+ * (one private grid per thread, summed afterwards) and drawn as one textured
+ * full-screen quad. The cost of drawing only depends on the grid size. */
+typedef struct{
+        float* accum;
+        View_Bounds bounds;
+        unsigned int slice;
+        unsigned int slices;
+}Density_Job;
+
+void init_density_lod(){
+        densityProgram = create_shader_program(densityVertexShaderSource, densityFragmentShaderSource);
+
+        const float quad[] = {-1.0f, -1.0f,
+                               1.0f, -1.0f,
+                              -1.0f,  1.0f,
+                               1.0f,  1.0f};
+        glGenBuffers(1, &VBO_quad);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO_quad);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+
+        glGenTextures(1, &densityTexture);
+        glBindTexture(GL_TEXTURE_2D, densityTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        lod_threads = SDL_GetCPUCount();
+        if(lod_threads < 1) lod_threads = 1;
+        if(lod_threads > LOD_MAX_THREADS) lod_threads = LOD_MAX_THREADS;
+        lod_texels = (unsigned char*)malloc(4*LOD_GRID_WIDTH*LOD_GRID_HEIGHT);
+        if(lod_texels == NULL){
+                printf("ERROR: Could not allocate density grid\n");
+                exit(1);
+        }
+}
+
+void accumulate_density(const Particle_Array* array, const Density_Job* job){
+        unsigned int begin = (unsigned long long)array->size*job->slice/job->slices;
+        unsigned int end   = (unsigned long long)array->size*(job->slice+1)/job->slices;
+        const float scale_x = LOD_GRID_WIDTH/(job->bounds.max_x - job->bounds.min_x);
+        const float scale_y = LOD_GRID_HEIGHT/(job->bounds.max_y - job->bounds.min_y);
+        float* accum = job->accum;
+        for(unsigned int i = begin; i < end; i++){
+                // Grid covers exactly what the orthographic camera sees
+                float fx = (array->position_x[i] - job->bounds.min_x)*scale_x;
+                float fy = (array->position_y[i] - job->bounds.min_y)*scale_y;
+                if(fx < 0.0f || fx >= LOD_GRID_WIDTH || fy < 0.0f || fy >= LOD_GRID_HEIGHT) continue;
+                int gx = (int)fx;
+                int gy = (int)fy;
+
+                Color_RGBA color = particle_color(array->descriptor[i]);
+                float* cell = &accum[(gy*LOD_GRID_WIDTH + gx)*4];
+                cell[0] += color.R;
+                cell[1] += color.G;
+                cell[2] += color.B;
+                cell[3] += 1.0f;
+        }
+}
+
+int density_worker(void* data){
+        Density_Job* job = (Density_Job*)data;
+        memset(job->accum, 0, sizeof(float)*4*LOD_GRID_WIDTH*LOD_GRID_HEIGHT);
+        for(unsigned int i = 0; i < archetype_count; i++)
+                accumulate_density(&archetypes[i].particles, job);
+        return 0;
+}
+
+float build_density_grid(){
+        const unsigned int cells = LOD_GRID_WIDTH*LOD_GRID_HEIGHT;
+        // lod_threads grids of {R, G, B, count} per cell
+        float* lod_accum = (float*)arena_alloc(&frame_arena, sizeof(float)*4*cells*lod_threads);
+        Density_Job jobs[LOD_MAX_THREADS];
+        SDL_Thread* threads[LOD_MAX_THREADS];
+        for(unsigned int t = 0; t < lod_threads; t++){
+                jobs[t].accum  = &lod_accum[t*cells*4];
+                jobs[t].bounds = get_view_bounds(0.0f);
+                jobs[t].slice  = t;
+                jobs[t].slices = lod_threads;
+        }
+        // The calling thread takes slice 0 instead of waiting idle
+        for(unsigned int t = 1; t < lod_threads; t++){
+                threads[t] = SDL_CreateThread(density_worker, "density", &jobs[t]);
+                if(threads[t] == NULL) density_worker(&jobs[t]);
+        }
+        density_worker(&jobs[0]);
+        for(unsigned int t = 1; t < lod_threads; t++){
+                if(threads[t] != NULL) SDL_WaitThread(threads[t], NULL);
+        }
+
+        // Reduce into the first grid
+        float max_count = 0.0f;
+        for(unsigned int t = 1; t < lod_threads; t++){
+                const float* src = &lod_accum[t*cells*4];
+                for(unsigned int c = 0; c < cells*4; c++)
+                        lod_accum[c] += src[c];
+        }
+        for(unsigned int c = 0; c < cells; c++){
+                if(lod_accum[c*4 + 3] > max_count) max_count = lod_accum[c*4 + 3];
+        }
+
+        const float log_max = logf(1.0f + max_count);
+        for(unsigned int c = 0; c < cells; c++){
+                const float* cell = &lod_accum[c*4];
+                unsigned char* texel = &lod_texels[c*4];
+                if(cell[3] == 0.0f){
+                        texel[0] = texel[1] = texel[2] = texel[3] = 0;
+                        continue;
+                }
+                texel[0] = (unsigned char)(255.0f*fminf(cell[0]/cell[3], 1.0f));
+                texel[1] = (unsigned char)(255.0f*fminf(cell[1]/cell[3], 1.0f));
+                texel[2] = (unsigned char)(255.0f*fminf(cell[2]/cell[3], 1.0f));
+                texel[3] = (unsigned char)(255.0f*logf(1.0f + cell[3])/log_max);
+        }
+        return max_count;
+}
+
+void draw_fullscreen_quad(){
+        glBindBuffer(GL_ARRAY_BUFFER, VBO_quad);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void draw_density(){
+        float max_count = build_density_grid();
+
+        glBindTexture(GL_TEXTURE_2D, densityTexture);
+        if(density_texture_ready == FALSE){
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, LOD_GRID_WIDTH, LOD_GRID_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, lod_texels);
+                density_texture_ready = TRUE;
+        }else{
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LOD_GRID_WIDTH, LOD_GRID_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, lod_texels);
+        }
+
+        glUseProgram(densityProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(densityProgram, "densityMap"), 0);
+        glUniform1f(glGetUniformLocation(densityProgram, "maxDensity"), max_count);
+        glUniform1f(glGetUniformLocation(densityProgram, "exposure"), 0.5f);
 
+        glDisable(GL_DEPTH_TEST);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // Colour is premultiplied by intensity
+        draw_fullscreen_quad();
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glEnable(GL_DEPTH_TEST);
+}
+
+/* Trails
+ * The scene is drawn into trailFBO, which is never cleared while trails are
+ * on. Each frame one full-screen pass darkens it by trail_fade before the
+ * current particles go on top, and one more pass copies it to the window, so
+ * trail length costs nothing. In RGBA8 the multiply rounds values of about
+ * 6/255 and less back to themselves, so a second pass subtracts
+ * TRAIL_FADE_STEP to take faint trails to black. */
+void init_trails(){
+        fadeProgram = create_shader_program(densityVertexShaderSource, fadeFragmentShaderSource);
+        blitProgram = create_shader_program(densityVertexShaderSource, blitFragmentShaderSource);
+
+        glGenTextures(1, &trailTexture);
+        glBindTexture(GL_TEXTURE_2D, trailTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+        glGenRenderbuffers(1, &trailDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, trailDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, SCREEN_WIDTH, SCREEN_HEIGHT);
+
+        glGenFramebuffers(1, &trailFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, trailFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, trailTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, trailDepth);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+                printf("ERROR: Trail framebuffer is incomplete, trails disabled\n");
+                glDeleteFramebuffers(1, &trailFBO);
+                trailFBO = 0;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void fade_trails(){
+        glDisable(GL_DEPTH_TEST);
+        if(trails_clear == TRUE){
+                glClear(GL_COLOR_BUFFER_BIT);
+                trails_clear = FALSE;
+        }else{
+                glUseProgram(fadeProgram);
+                const int colour = glGetUniformLocation(fadeProgram, "colour");
+                glUniform4f(colour, 0.0f, 0.0f, 0.0f, trail_fade);
+                draw_fullscreen_quad();
+                // Destination minus source
+                glBlendEquation(GL_FUNC_REVERSE_SUBTRACT);
+                glBlendFunc(GL_ONE, GL_ONE);
+                glUniform4f(colour, TRAIL_FADE_STEP, TRAIL_FADE_STEP, TRAIL_FADE_STEP, TRAIL_FADE_STEP);
+                draw_fullscreen_quad();
+                glBlendEquation(GL_FUNC_ADD);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+}
+
+void blit_trails(){
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glUseProgram(blitProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, trailTexture);
+        glUniform1i(glGetUniformLocation(blitProgram, "screenTexture"), 0);
+        draw_fullscreen_quad();
+        glEnable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+}
+
+/* Bakes a curl noise flow field once, so each particle pays a bilinear
+ * lookup per step instead of noise evaluations. The stream function is
+ * Perlin noise on a 4D torus, which makes the grid wrap on both axes. */
+void init_turbulence(){
+        const unsigned int cells = TURBULENCE_SIZE*TURBULENCE_SIZE;
+        float* potential = (float*)malloc(sizeof(float)*cells);
+        turbulence_x = (float*)malloc(sizeof(float)*cells);
+        turbulence_y = (float*)malloc(sizeof(float)*cells);
+        if(potential == NULL || turbulence_x == NULL || turbulence_y == NULL){
+                printf("ERROR: Could not allocate the turbulence field\n");
+                exit(1);
+        }
+        for(int j = 0; j < TURBULENCE_SIZE; j++){
+                for(int i = 0; i < TURBULENCE_SIZE; i++){
+                        float u = 2.0f*GLM_PIf*i/TURBULENCE_SIZE;
+                        float v = 2.0f*GLM_PIf*j/TURBULENCE_SIZE;
+                        vec4 point = {TURBULENCE_RADIUS*cosf(u), TURBULENCE_RADIUS*sinf(u),
+                                      TURBULENCE_RADIUS*cosf(v), TURBULENCE_RADIUS*sinf(v)};
+                        potential[j*TURBULENCE_SIZE + i] = glm_perlin_vec4(point);
+                }
+        }
+
+        // The curl has no divergence, so particles swirl instead of bunching up
+        const int mask = TURBULENCE_SIZE - 1;
+        float peak = 0.0f;
+        for(int j = 0; j < TURBULENCE_SIZE; j++){
+                for(int i = 0; i < TURBULENCE_SIZE; i++){
+                        float dx = potential[j*TURBULENCE_SIZE + ((i + 1) & mask)] - potential[j*TURBULENCE_SIZE + ((i - 1) & mask)];
+                        float dy = potential[((j + 1) & mask)*TURBULENCE_SIZE + i] - potential[((j - 1) & mask)*TURBULENCE_SIZE + i];
+                        turbulence_x[j*TURBULENCE_SIZE + i] =  dy;
+                        turbulence_y[j*TURBULENCE_SIZE + i] = -dx;
+                        float speed = sqrtf(dx*dx + dy*dy);
+                        if(speed > peak) peak = speed;
+                }
+        }
+        if(peak > 0.0f){
+                glm_vec2_array_scale(turbulence_x, turbulence_y, 1.0f/peak, turbulence_x, turbulence_y, cells);
+        }
+        free(potential);
+}
+
+// Bilinear, with the grid repeating in both directions
+void sample_turbulence(float x, float y, vec2 out){
+        const float scale = TURBULENCE_SIZE/TURBULENCE_PERIOD;
+        float gx = (x + turbulence_offset[0])*scale;
+        float gy = (y + turbulence_offset[1])*scale;
+        float fx = floorf(gx);
+        float fy = floorf(gy);
+        float tx = gx - fx;
+        float ty = gy - fy;
+        int x0 = (int)fx & (TURBULENCE_SIZE - 1);
+        int y0 = (int)fy & (TURBULENCE_SIZE - 1);
+        int x1 = (x0 + 1) & (TURBULENCE_SIZE - 1);
+        int y1 = (y0 + 1) & (TURBULENCE_SIZE - 1);
+        const float* field[] = {turbulence_x, turbulence_y};
+        for(int c = 0; c < 2; c++){
+                float a = field[c][y0*TURBULENCE_SIZE + x0] + (field[c][y0*TURBULENCE_SIZE + x1] - field[c][y0*TURBULENCE_SIZE + x0])*tx;
+                float b = field[c][y1*TURBULENCE_SIZE + x0] + (field[c][y1*TURBULENCE_SIZE + x1] - field[c][y1*TURBULENCE_SIZE + x0])*tx;
+                out[c] = a + (b - a)*ty;
+        }
+}
+
+/* Adds strength times the flow at each particle to forces. With SSE2 the
+ * cell and weights of 4 particles are computed at once; the 16 corner loads
+ * stay scalar since SSE2 has no gather. */
+void apply_turbulence(const Particle_Array* particles, const float strength){
+        unsigned int i = 0;
+#if defined(__SSE2__)
+        const __m128 scale    = _mm_set1_ps(TURBULENCE_SIZE/TURBULENCE_PERIOD);
+        const __m128 offset_x = _mm_set1_ps(turbulence_offset[0]);
+        const __m128 offset_y = _mm_set1_ps(turbulence_offset[1]);
+        const __m128 amount   = _mm_set1_ps(strength);
+        const __m128i mask    = _mm_set1_epi32(TURBULENCE_SIZE - 1);
+        const __m128i step    = _mm_set1_epi32(1);
+        for(; i + 4 <= particles->size; i += 4){
+                __m128 gx = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&particles->position_x[i]), offset_x), scale);
+                __m128 gy = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&particles->position_y[i]), offset_y), scale);
+                // Truncation rounds negatives up, step those down one to get floor
+                __m128i ix = _mm_cvttps_epi32(gx);
+                __m128i iy = _mm_cvttps_epi32(gy);
+                __m128 below_x = _mm_cmplt_ps(gx, _mm_cvtepi32_ps(ix));
+                __m128 below_y = _mm_cmplt_ps(gy, _mm_cvtepi32_ps(iy));
+                ix = _mm_add_epi32(ix, _mm_castps_si128(below_x));
+                iy = _mm_add_epi32(iy, _mm_castps_si128(below_y));
+                __m128 tx = _mm_sub_ps(gx, _mm_cvtepi32_ps(ix));
+                __m128 ty = _mm_sub_ps(gy, _mm_cvtepi32_ps(iy));
+
+                __m128i x0 = _mm_and_si128(ix, mask);
+                __m128i x1 = _mm_and_si128(_mm_add_epi32(ix, step), mask);
+                __m128i y0 = _mm_slli_epi32(_mm_and_si128(iy, mask), TURBULENCE_SHIFT);
+                __m128i y1 = _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(iy, step), mask), TURBULENCE_SHIFT);
+                int corner[4][4];
+                _mm_storeu_si128((__m128i*)corner[0], _mm_add_epi32(y0, x0));
+                _mm_storeu_si128((__m128i*)corner[1], _mm_add_epi32(y0, x1));
+                _mm_storeu_si128((__m128i*)corner[2], _mm_add_epi32(y1, x0));
+                _mm_storeu_si128((__m128i*)corner[3], _mm_add_epi32(y1, x1));
+
+                const float* field[] = {turbulence_x, turbulence_y};
+                float* force[] = {&forces.x[i], &forces.y[i]};
+                for(int c = 0; c < 2; c++){
+                        const float* f = field[c];
+                        __m128 c00 = _mm_set_ps(f[corner[0][3]], f[corner[0][2]], f[corner[0][1]], f[corner[0][0]]);
+                        __m128 c10 = _mm_set_ps(f[corner[1][3]], f[corner[1][2]], f[corner[1][1]], f[corner[1][0]]);
+                        __m128 c01 = _mm_set_ps(f[corner[2][3]], f[corner[2][2]], f[corner[2][1]], f[corner[2][0]]);
+                        __m128 c11 = _mm_set_ps(f[corner[3][3]], f[corner[3][2]], f[corner[3][1]], f[corner[3][0]]);
+                        __m128 a = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(c10, c00), tx));
+                        __m128 b = _mm_add_ps(c01, _mm_mul_ps(_mm_sub_ps(c11, c01), tx));
+                        __m128 flow = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), ty));
+                        _mm_storeu_ps(force[c], _mm_add_ps(_mm_loadu_ps(force[c]), _mm_mul_ps(flow, amount)));
+                }
+        }
+#endif
+        for(; i < particles->size; i++){
+                vec2 flow;
+                sample_turbulence(particles->position_x[i], particles->position_y[i], flow);
+                forces.x[i] += flow[0]*strength;
+                forces.y[i] += flow[1]*strength;
+        }
+}
+
+// Creates the buffers of the next mesh at full size, the data follows in upload_static_meshes
+int begin_mesh_upload(const Obj_Loaded* loaded){
+        const Mesh_Data* data = &loaded->mesh;
+        if(loaded->valid == FALSE){
+                printf("ERROR: %s has invalid faces, skipped\n", loaded->filename);
+                return FALSE;
+        }
+        if(data->index_size == 4 && element_index_uint == FALSE){
+                printf("ERROR: %s has %u vertices and GL_OES_element_index_uint is missing, skipped\n", loaded->filename, data->vertex_count);
+                return FALSE;
+        }
+
+        Static_Mesh* mesh = &meshes[mesh_count];
+        glGenBuffers(1, &mesh->VBO);
+        glGenBuffers(1, &mesh->EBO);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+        glBufferData(GL_ARRAY_BUFFER, OBJ_VERTEX_STRIDE*data->vertex_count, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, data->index_size*data->index_count, NULL, GL_STATIC_DRAW);
+        mesh->index_count = data->index_count;
+        mesh->index_type  = data->index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        mesh_upload_offset = 0;
+        return TRUE;
+}
+
+/* Sends at most budget bytes of the meshes finished by the loader thread.
+ * A mesh is only drawn once all of it is on the GPU. */
+void upload_static_meshes(size_t budget){
+        while(budget > 0){
+                if(mesh_uploading == FALSE){
+                        if(obj_async_poll(&mesh_load, &mesh_upload) == FALSE) return;
+                        if(begin_mesh_upload(&mesh_upload) == FALSE){
+                                free_mesh_data(&mesh_upload.mesh);
+                                continue;
+                        }
+                        mesh_uploading = TRUE;
+                }
+
+                const Mesh_Data* data = &mesh_upload.mesh;
+                const Static_Mesh* mesh = &meshes[mesh_count];
+                const size_t vertex_bytes = OBJ_VERTEX_STRIDE*data->vertex_count;
+                const size_t index_bytes  = (size_t)data->index_size*data->index_count;
+                size_t size;
+                if(mesh_upload_offset < vertex_bytes){
+                        size = vertex_bytes - mesh_upload_offset;
+                        if(size > budget) size = budget;
+                        glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+                        glBufferSubData(GL_ARRAY_BUFFER, mesh_upload_offset, size, (const char*)data->vertices + mesh_upload_offset);
+                }else{
+                        const size_t offset = mesh_upload_offset - vertex_bytes;
+                        size = index_bytes - offset;
+                        if(size > budget) size = budget;
+                        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+                        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, offset, size, (const char*)data->indices + offset);
+                }
+                mesh_upload_offset += size;
+                budget -= size;
+
+                if(mesh_upload_offset == vertex_bytes + index_bytes){
+                        mesh_count++;
+                        mesh_uploading = FALSE;
+                        free_mesh_data(&mesh_upload.mesh);
+                }
+        }
+}
+
+void draw_static_meshes(){
+        if(mesh_count == 0) return;
+
+        // Meshes use particle coordinates, which are drawn with y/1.33
+        mat4 model;
+        glm_mat4_identity(model);
+        glm_scale(model, (vec3){1.0f, 1.0f/1.33f, 1.0f});
+        mat4 view;
+        mat4 proj;
+        camera_matrices(view, proj);
+
+        glUseProgram(meshProgram);
+        glUniform4f(glGetUniformLocation(meshProgram, "ourColor"), 0.35f, 0.40f, 0.50f, 0.35f);
+        glUniformMatrix4fv(glGetUniformLocation(meshProgram, "model"),      1, GL_FALSE, (const float*)model);
+        glUniformMatrix4fv(glGetUniformLocation(meshProgram, "view"),       1, GL_FALSE, (const float*)view);
+        glUniformMatrix4fv(glGetUniformLocation(meshProgram, "projection"), 1, GL_FALSE, (const float*)proj);
+        int normalLocation = glGetAttribLocation(meshProgram, "aNormal");
+        for(unsigned int i = 0; i < mesh_count; i++){
+                glBindBuffer(GL_ARRAY_BUFFER, meshes[i].VBO);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshes[i].EBO);
+                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, OBJ_VERTEX_STRIDE, (void*)0);
+                glEnableVertexAttribArray(0);
+                if(normalLocation >= 0){
+                        glVertexAttribPointer(normalLocation, 3, GL_FLOAT, GL_FALSE, OBJ_VERTEX_STRIDE, (void*)(5*sizeof(float)));
+                        glEnableVertexAttribArray(normalLocation);
+                }
+                glDrawElements(GL_TRIANGLES, meshes[i].index_count, meshes[i].index_type, (void*)0);
+        }
+        // The other programs only feed attribute 0
+        if(normalLocation >= 0) glDisableVertexAttribArray(normalLocation);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void init() {
+        srand(SDL_GetTicks());
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        //glEnable(GL_PROGRAM_POINT_SIZE);
+        //glEnable(GL_MULTISAMPLE);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        shaderProgram = create_shader_program(vertexShaderSource, fragmentShaderSource);
+        init_density_lod();
+        init_trails();
+        init_turbulence();
 
         //glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
 
-        //glGenVertexArrays(1, &VAO_faces);
-        glGenBuffers(1, &VBO_faces);
-        glGenBuffers(1, &EBO_faces);
+        meshProgram = create_shader_program(meshVertexShaderSource, meshFragmentShaderSource);
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        element_index_uint = extensions != NULL && strstr(extensions, "GL_OES_element_index_uint") != NULL;
 
 
         //glBindVertexArray(VAO);
@@ -320,7 +1424,7 @@ void init() {
 void input(int * quit){
         SDL_Event e;
         //nk_input_begin(ctx);
-        const float camera_speed = 0.1f;
+        const float camera_speed = 0.02f;
         const Uint8* states = SDL_GetKeyboardState(NULL);
         while(SDL_PollEvent(&e)){
                 switch(e.type){
@@ -338,11 +1442,42 @@ void input(int * quit){
                                                 SDL_GetRelativeMouseState(NULL, NULL);
                                         }
                                 }
+                                if(e.key.keysym.sym == SDLK_t && trailFBO != 0){
+                                        trails = !trails;
+                                        trails_clear = TRUE;
+                                }
+                                if(e.key.keysym.sym == SDLK_F3)
+                                        show_stats = !show_stats;
+                                if(e.key.keysym.sym == SDLK_b){
+                                        budget_policy = (budget_policy + 1) % BUDGET_POLICY_COUNT;
+                                        printf("Budget policy: %s\n", budget_policy_name(budget_policy));
+                                }
+                                if(e.key.keysym.sym == SDLK_f){
+                                        turbulence = !turbulence;
+                                        printf("Turbulence: %s\n", turbulence == TRUE ? "on" : "off");
+                                }
+                                if(e.key.keysym.sym == SDLK_v){
+                                        Frame_Pace_Mode next = (pacer.mode + 1) % FRAME_PACE_MODE_COUNT;
+                                        if(frame_pacer_set_mode(&pacer, next) != next) // Fell back, skip it
+                                                frame_pacer_set_mode(&pacer, (next + 1) % FRAME_PACE_MODE_COUNT);
+                                        printf("Frame pacing: %s\n", frame_pace_mode_name(pacer.mode));
+                                }
                                 break;  
+                        case SDL_MOUSEWHEEL:
+                                zoom *= powf(1.1f, e.wheel.y);
+                                if(zoom < 0.5f) zoom = 0.5f;
+                                if(zoom > 1000.0f) zoom = 1000.0f;
+                                break;
                 }
                 //nk_sdl_handle_event(&e);
         }
 
+        // Pan, slower when zoomed in so the speed on screen stays the same
+        if(states[SDL_SCANCODE_W]) camera_pos[1] += camera_speed/zoom;
+        if(states[SDL_SCANCODE_S]) camera_pos[1] -= camera_speed/zoom;
+        if(states[SDL_SCANCODE_D]) camera_pos[0] += camera_speed/zoom;
+        if(states[SDL_SCANCODE_A]) camera_pos[0] -= camera_speed/zoom;
+
         const float sensitivity = 0.25;
         int x = 0, y = 0;
         if(SDL_GetRelativeMouseMode() == SDL_TRUE)
@@ -364,22 +1499,34 @@ void input(int * quit){
 }
 
 void particle_array_push(Particle_Array* array, Particle particle){
-        if( array->capacity == 0){
-                array->particle = (Particle*)malloc(sizeof(Particle));
-                array->particle[0] = particle;
-                array->size++;
-                array->capacity++;
-                return;
-        }
         if( array->size == array->capacity ){
-                array->particle = (Particle*)realloc(array->particle, sizeof(Particle)*(array->size+1));
-                array->capacity++;
+                particle_array_reserve(array, array->capacity == 0 ? 64 : array->capacity*2);
         }
-        array->particle[array->size] = particle;
+        particle_array_set(array, array->size, particle);
+        handle_alloc(array, array->size);
         array->size++;
         return;
 }
 
+// Moves the last particle into the hole, only its handle entry changes
+void particle_array_remove(Particle_Array* array, const unsigned int i){
+        handle_free(array, array->handle[i]);
+        const unsigned int last = array->size - 1;
+        if(i != last){
+                particle_array_set(array, i, particle_array_get(array, last));
+                array->handle[i] = array->handle[last];
+                array->handles.slot[particle_handle_index(array->handle[i])] = i;
+        }
+        array->size--;
+}
+
+// A new particle takes over slot i, with a new handle
+void particle_array_replace(Particle_Array* array, const unsigned int i, const Particle particle){
+        handle_free(array, array->handle[i]);
+        particle_array_set(array, i, particle);
+        handle_alloc(array, i);
+}
+
 void create_random_particles(Particle_Array* array, const unsigned int quantity){
         for(int i = 0; i < quantity; i++){
                 Particle particle;
@@ -387,252 +1534,875 @@ void create_random_particles(Particle_Array* array, const unsigned int quantity)
                 particle.position[1] = ((rand() % 98)-49)/50.0f;
                 particle.velocity[0] = ((rand() % 100)-50)/50.0f;
                 particle.velocity[1] = ((rand() % 100)-50)/50.0f;
-                particle.type = QUARK_UP;
+                particle.descriptor = make_descriptor(QUARK_UP, FALSE, COLOUR_NONE);
                 particle_array_push(array, particle);
         }
 }
 
-void spawn_particle(Particle_Array* particles, Particle_Type type, int isAnti, vec2 position, vec2 velocity){
+// Reserves every archetype up to its limit, so spawning never allocates
+void init_budgets(){
+        for(unsigned int i = 0; i < archetype_count; i++)
+                particle_array_reserve(&archetypes[i].particles, archetypes[i].budget.limit);
+}
+
+/* Where the next bound state of the archetype goes: its size to append, the
+ * first slot of an old group to overwrite, or -1 when the budgets and
+ * budget_policy refuse it. */
+long budget_slot(Archetype* archetype){
+        const Particle_Array* array = &archetype->particles;
+        Particle_Budget* budget = &archetype->budget;
+        const unsigned int group = archetype->group;
+        const unsigned int total = particle_total();
+        const int full = array->size + group > budget->limit ||
+                         total + group > particle_limit;
+        if(full == FALSE){
+                if(budget_policy == BUDGET_THROTTLE){
+                        float fill = (float)array->size/budget->limit;
+                        if((float)total/particle_limit > fill) fill = (float)total/particle_limit;
+                        float chance = (1.0f - fill)/(1.0f - BUDGET_THROTTLE_START);
+                        if(fill > BUDGET_THROTTLE_START && rand() > chance*RAND_MAX){
+                                budget->throttled++;
+                                return -1;
+                        }
+                }
+                return array->size;
+        }
+        const unsigned int groups = array->size/group;
+        if(budget_policy == BUDGET_MERGE && groups > 0){
+                budget->merged++;
+                budget->next_merge = (budget->next_merge + 1) % groups;
+                return (long)budget->next_merge*group;
+        }
+        budget->dropped++;
+        return -1;
+}
+
+// slot is particles->size to append, or a particle to overwrite
+void spawn_particle(Particle_Array* particles, const unsigned int slot, Particle_Type type, int isAnti, Colour_Charge colour, vec2 position, vec2 velocity){
         Particle new_particle;
-        new_particle.type = type;
+        new_particle.descriptor = make_descriptor(type, isAnti, colour);
         glm_vec2_copy(position, new_particle.position);
         glm_vec2_copy(velocity, new_particle.velocity);
-        new_particle.isAntiparticle = isAnti;
-        particle_array_push(particles, new_particle);
+        if(slot == particles->size) particle_array_push(particles, new_particle);
+        else particle_array_replace(particles, slot, new_particle);
 }
 
-void spawn_meson(vec2 position1, vec2 velocity1, vec2 position2, vec2 velocity2){
-        spawn_particle(&mesons, QUARK_UP, 0, position1, velocity1);
-        spawn_particle(&mesons, QUARK_UP, 1, position2, velocity2);
+// Returns FALSE if the meson budget refused it
+int spawn_meson(vec2 position1, vec2 velocity1, vec2 position2, vec2 velocity2){
+        long slot = budget_slot(mesons);
+        if(slot < 0) return FALSE;
+        // A colour and its anticolour, so the meson is colourless
+        Colour_Charge colour = COLOUR_RED + rand() % 3;
+        spawn_particle(&mesons->particles, slot,     mesons->species, 0, colour, position1, velocity1);
+        spawn_particle(&mesons->particles, slot + 1, mesons->species, 1, colour, position2, velocity2);
+        return TRUE;
 }
 
-void remove_meson(const unsigned int ID){
-        if(ID*2 >= mesons.size){
-                printf("ERROR: Meson ID greater than size\n");
+// Removes bound state ID, the last one takes its place with its quarks in the same order
+void remove_group(Archetype* archetype, const unsigned int ID){
+        const unsigned int group = archetype->group;
+        if(ID*group >= archetype->particles.size){
+                printf("ERROR: %s ID greater than size\n", archetype->name);
                 exit(1);
         }
-        if(ID == (mesons.size/2) - 1){
-                mesons.size -= 2;
-                return;
-        }
-        mesons.particle[ID*2]     = mesons.particle[mesons.size-2];
-        mesons.particle[(ID*2)+1] = mesons.particle[mesons.size-1];
-        mesons.size -= 2;
-        return;
+        for(int i = group - 1; i >= 0; i--)
+                particle_array_remove(&archetype->particles, ID*group + i);
 }
 
 void spawn_baryon(){
+        long slot = budget_slot(baryons);
+        if(slot < 0) return;
         for(int i = 0; i < 3; i++){
                 float positionX = ((rand() % 98)-49)/50.0f;
                 float positionY = ((rand() % 98)-49)/50.0f;
                 float velX = ((rand() % 98)-49)/50.0f;
                 float velY = ((rand() % 98)-49)/50.0f;
-                spawn_particle(&baryons, QUARK_UP, FALSE, (vec2){positionX, positionY}, (vec2){velX,velY});
+                spawn_particle(&baryons->particles, slot + i, baryons->species, FALSE, COLOUR_RED + i, (vec2){positionX, positionY}, (vec2){velX,velY});
+        }
+}
+
+/* Random tetraquark or pentaquark. Quarks come in colour and anticolour
+ * pairs, a pentaquark has a red, green and blue triple first, so both are
+ * colourless. */
+void spawn_exotic(Archetype* archetype){
+        long slot = budget_slot(archetype);
+        if(slot < 0) return;
+        const unsigned int triple = archetype->group % 2 == 1 ? 3 : 0;
+        Colour_Charge colour = COLOUR_RED;
+        for(unsigned int i = 0; i < archetype->group; i++){
+                int isAnti = FALSE;
+                if(i < triple) colour = COLOUR_RED + i;
+                else if((i - triple) % 2 == 0) colour = COLOUR_RED + rand() % 3;
+                else isAnti = TRUE;
+                float positionX = ((rand() % 98)-49)/50.0f;
+                float positionY = ((rand() % 98)-49)/50.0f;
+                float velX = ((rand() % 98)-49)/50.0f;
+                float velY = ((rand() % 98)-49)/50.0f;
+                spawn_particle(&archetype->particles, slot + i, archetype->species, isAnti, colour, (vec2){positionX, positionY}, (vec2){velX,velY});
         }
 }
 
 void spawn_photon(vec2 position, vec2 velocity){
-        spawn_particle(&photons, PHOTON, FALSE, position, velocity);
+        long slot = budget_slot(photons);
+        if(slot < 0) return;
+        spawn_particle(&photons->particles, slot, photons->species, FALSE, COLOUR_NONE, position, velocity);
 }
 // When destroying copy the last place to here and pop it
 
 void check_boundaries(Particle_Array particles){
         for(int i = 0; i < particles.size; i++){
-                vec2 velocity;
-                glm_vec2_copy(particles.particle[i].velocity, velocity);
-                if(particles.particle[i].position[0] > 1 && velocity[0] > 0) particles.particle[i].velocity[0] *= -1;
-                if(particles.particle[i].position[0] < -1 && velocity[0] < 0) particles.particle[i].velocity[0] *= -1;
-                if(particles.particle[i].position[1] > 1 && velocity[1] > 0) particles.particle[i].velocity[1] *= -1;
-                if(particles.particle[i].position[1] < -1 && velocity[1] < 0) particles.particle[i].velocity[1] *= -1;
+                vec2 velocity = {particles.velocity_x[i], particles.velocity_y[i]};
+                if(particles.position_x[i] > 1 && velocity[0] > 0) particles.velocity_x[i] *= -1;
+                if(particles.position_x[i] < -1 && velocity[0] < 0) particles.velocity_x[i] *= -1;
+                if(particles.position_y[i] > 1 && velocity[1] > 0) particles.velocity_y[i] *= -1;
+                if(particles.position_y[i] < -1 && velocity[1] < 0) particles.velocity_y[i] *= -1;
         }
 }
 
 void strong_force_produce_pair(){
 }
 
-void update_photons(float delta_time){
-        for(int i = 0; i < photons.size; i++){
-                Particle part1 = photons.particle[i];
-                glm_vec2_normalize(part1.velocity);
-                glm_vec2_scale(part1.velocity, SPEED_OF_C, part1.velocity);
-                photons.particle[i] = part1;
-                photons.particle[i].position[0] += photons.particle[i].velocity[0]*delta_time;
-                photons.particle[i].position[1] += photons.particle[i].velocity[1]*delta_time;
-        }
-        check_boundaries(photons);
-}
-
-void update_baryons(float delta_time){
-        if(baryons.size % 3 != 0) exit(1); // Baryons need 3 quarks
-
-        // Strong force between 3 quarks
-        for(int i = 0; i < baryons.size/3; i++){
-                vec2 force[] = {{0.0f, 0.0f}, {0.0f, 0.0f}, {0.0f, 0.0f}};
-
-                Particle part[3];
-                part[0] = baryons.particle[i*3];
-                part[1] = baryons.particle[i*3 + 1];
-                part[2] = baryons.particle[i*3 + 2];
-
-                float mid_x = (part[0].position[0] + part[1].position[0] + part[2].position[0])/3;
-                float mid_y = (part[0].position[1] + part[1].position[1] + part[2].position[1])/3;
-                vec2 middle_point = {mid_x, mid_y};
-
-                for(int j = 0; j < 3; j++){
-                        float dist_squared = glm_vec2_distance2(part[j].position, middle_point);
-                        float max_dist = 0.2;
-                        // Pair creation
-                        if(dist_squared > pow(max_dist,2)){
-                                vec2 middle_middle;
-                                glm_vec2_add(middle_point, part[j].position, middle_middle);
-                                glm_vec2_scale(middle_middle, 0.5, middle_middle);
-                                spawn_meson(part[j].position, part[j].velocity, middle_middle, part[j].velocity);
-                                glm_vec2_copy(middle_middle, part[j].position);
-                                // Update velocity too 
-                        }
-                }
+void update_photons(Archetype* archetype, unsigned int begin, unsigned int end, float delta_time){
+        // Each chunk stays in L1 through all four passes, so the columns are streamed once
+        for(unsigned int first = begin; first < end; first += FUSED_CHUNK){
+                Particle_Array photons = particle_array_tile(&archetype->particles, first,
+                                                             first + FUSED_CHUNK < end ? first + FUSED_CHUNK : end);
+                // Photons always move at c
+                glm_vec2_array_normalize(photons.velocity_x, photons.velocity_y, photons.size);
+                glm_vec2_array_scale(photons.velocity_x, photons.velocity_y, SPEED_OF_C,
+                                     photons.velocity_x, photons.velocity_y, photons.size);
+                glm_vec2_array_muladds(photons.velocity_x, photons.velocity_y, delta_time,
+                                       photons.position_x, photons.position_y, photons.size);
+                check_boundaries(photons);
+        }
+}
 
-                // Attraction forces between quarks 
-                for(int j = 0; j < 3; j++){
-                        for(int k = 0; k < 2; k++){
-                                float dist_squared = glm_vec2_distance2(part[j].position, part[(j+1+k)%3].position);
-                                float min_dist = 0.055;
-                                if(dist_squared <= pow(min_dist,2)) continue;  // Asymptotic freedom
-                                vec2 forceDir[2];
-                                glm_vec2_sub(part[j].position, part[(j+1+k)%3].position, forceDir[k]);
-                                glm_vec2_norm(forceDir[k]);
-
-                                float forceMag = -FORCE_MULTIPLIER;
-                                glm_vec2_scale(forceDir[k], forceMag, forceDir[k]);
-                                glm_vec2_add(force[j], forceDir[k], force[j]);
-                        }
-                }
+/* Drag, velocity and position of every particle in the array. The systems
+ * pass it one FUSED_CHUNK view from integrate_chunk, so its passes run while
+ * the chunk is still in L1. forces holds the strong force of each particle
+ * of the view. */
+void integrate_particles(Particle_Array* particles, float delta_time){
+        const unsigned int size = particles->size;
+        // Drag
+        glm_vec2_array_muladds(particles->velocity_x, particles->velocity_y, -0.1f, forces.x, forces.y, size);
+        // UPDATE VELOCITIES
+        glm_vec2_array_muladds(forces.x, forces.y, delta_time, particles->velocity_x, particles->velocity_y, size);
+        // Max Velocity
+        glm_vec2_array_clamp_length(particles->velocity_x, particles->velocity_y, SPEED_OF_C, size);
+        // UPDATE POSITIONS
+        glm_vec2_array_muladds(particles->velocity_x, particles->velocity_y, delta_time,
+                               particles->position_x, particles->position_y, size);
+}
 
-                for(int j = 0; j < 3; j++){
-                        // Drag
-                        vec2 drag = {0.0f, 0.0f};
-                        glm_vec2_copy(part[j].velocity, drag);
-                        glm_vec2_negate(drag);
-                        glm_vec2_scale(drag, 0.1, drag);
-                        glm_vec2_add(force[j], drag, force[j]);
-
-                        // UPDATE VELOCITIES
-                        glm_vec2_scale(force[j], delta_time, force[j]);
-                        glm_vec2_add(part[j].velocity, force[j], part[j].velocity); 
-
-                        // Max Velocity
-                        float mag_squared = glm_vec2_norm2(part[j].velocity);
-                        if(mag_squared > pow(SPEED_OF_C,2)){
-                                glm_vec2_normalize(part[j].velocity);
-                                glm_vec2_scale(part[j].velocity, SPEED_OF_C, part[j].velocity);
-                        }
-                }
-                baryons.particle[i*3]     = part[0];
-                baryons.particle[i*3 + 1] = part[1];
-                baryons.particle[i*3 + 2] = part[2];
+/* Everything after the strong force for particles [begin, end), a chunk of
+ * at most FUSED_CHUNK the force loop has just written, so every pass here
+ * reads it from L1. Turbulence, drag, velocity, speed limit, position, walls. */
+void integrate_chunk(Particle_Array* particles, const unsigned int begin, const unsigned int end, float delta_time){
+        Particle_Array chunk = particle_array_tile(particles, begin, end);
+        if(turbulence == TRUE) apply_turbulence(&chunk, TURBULENCE_STRENGTH);
+        integrate_particles(&chunk, delta_time);
+        // BOUNDARIES
+        check_boundaries(chunk);
+}
+
+/* Bound states of N quarks share one kernel, generated per N so the quark
+ * loops have constant trip counts and unroll, and the rules below are
+ * constants that fold away where they are 0. Arguments:
+ *   NAME            archetype name, gives NAME_force, NAME_forces_sse2 and update_NAME
+ *   N               quarks per bound state
+ *   ANNIHILATE_DIST quarks 0 and 1 closer than this turn into two photons, 0 for never
+ *   MAX_DIST        a quark further than this from the middle makes a meson, 0 for never
+ *   MIN_DIST        closer quark pairs feel no force, asymptotic freedom
+ * Macro bodies use block comments, a line comment would swallow the rest. */
+
+/* Strong force of bound state i, into the chunk's forces. Returns FALSE if it
+ * annihilated instead, the last one then sits at i. */
+#define BOUND_STATE_FORCE(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)                                         \
+int NAME##_force(Archetype* archetype, const int i, const unsigned int first){                                  \
+        Particle_Array* particles = &archetype->particles;                                                      \
+        Particle part[N];                                                                                       \
+        for(int j = 0; j < N; j++) part[j] = particle_array_get(particles, i*N + j);                            \
+                                                                                                                \
+        if(ANNIHILATE_DIST > 0){                                                                                \
+                const float annihilate_dist = ANNIHILATE_DIST;                                                  \
+                if(glm_vec2_distance2(part[0].position, part[1].position) <= pow(annihilate_dist, 2)){          \
+                        vec2 new_vel = {part[0].velocity[1], -part[0].velocity[0]};                             \
+                        vec2 new_vel2 = {-part[0].velocity[1], part[0].velocity[0]};                            \
+                        spawn_photon(part[0].position, new_vel);                                                \
+                        spawn_photon(part[0].position, new_vel2);                                               \
+                        remove_group(archetype, i);                                                             \
+                        return FALSE;                                                                           \
+                }                                                                                               \
+        }                                                                                                       \
+                                                                                                                \
+        /* Pair creation */                                                                                     \
+        if(MAX_DIST > 0){                                                                                       \
+                const float max_dist = MAX_DIST;                                                                \
+                vec2 middle_point = {part[0].position[0], part[0].position[1]};                                 \
+                for(int j = 1; j < N; j++) glm_vec2_add(middle_point, part[j].position, middle_point);          \
+                middle_point[0] /= N;                                                                           \
+                middle_point[1] /= N;                                                                           \
+                for(int j = 0; j < N; j++){                                                                     \
+                        if(glm_vec2_distance2(part[j].position, middle_point) <= pow(max_dist, 2)) continue;    \
+                        vec2 middle_middle;                                                                     \
+                        glm_vec2_add(middle_point, part[j].position, middle_middle);                            \
+                        glm_vec2_scale(middle_middle, 0.5, middle_middle);                                      \
+                        spawn_meson(part[j].position, part[j].velocity, middle_middle, part[j].velocity);       \
+                        glm_vec2_copy(middle_middle, part[j].position);                                         \
+                        particles->position_x[i*N + j] = middle_middle[0];                                      \
+                        particles->position_y[i*N + j] = middle_middle[1];                                      \
+                }                                                                                               \
+        }                                                                                                       \
+                                                                                                                \
+        /* Attraction forces between quarks */                                                                  \
+        const float min_dist = MIN_DIST;                                                                        \
+        for(int j = 0; j < N; j++){                                                                             \
+                vec2 force = {0.0f, 0.0f};                                                                      \
+                for(int k = 0; k < N - 1; k++){                                                                 \
+                        const int other = (j+1+k)%N;                                                            \
+                        if(glm_vec2_distance2(part[j].position, part[other].position) <= pow(min_dist, 2)) continue; \
+                        vec2 force_dir;                                                                         \
+                        glm_vec2_sub(part[j].position, part[other].position, force_dir);                        \
+                        glm_vec2_scale(force_dir, -FORCE_MULTIPLIER, force_dir);                                \
+                        glm_vec2_add(force, force_dir, force);                                                  \
+                }                                                                                               \
+                forces.x[i*N + j - first] = force[0];                                                           \
+                forces.y[i*N + j - first] = force[1];                                                           \
+        }                                                                                                       \
+        return TRUE;                                                                                            \
+}
+
+#if defined(__SSE2__)
+/* Largest float not above limit. A float compared against a double limit, as
+ * the scalar code does with pow, gives the same answer against this. */
+float float_below(const double limit){
+        float below = (float)limit;
+        if(below > limit) below = nextafterf(below, -INFINITY);
+        return below;
+}
+
+/* Lane l gets base[l*stride], which transposes 4 bound states so each
+ * register holds the same quark of all of them. SSE2 has no gather. */
+__m128 load_strided(const float* base, const int stride){
+        return _mm_set_ps(base[3*stride], base[2*stride], base[stride], base[0]);
+}
+
+void store_strided(float* base, const int stride, const __m128 value){
+        float lanes[4];
+        _mm_storeu_ps(lanes, value);
+        for(int l = 0; l < 4; l++) base[l*stride] = lanes[l];
+}
+
+/* NAME_force for bound states i to i+3, one per lane, same results bit for
+ * bit. The distance rules become lane masks. Annihilation removes states and
+ * reorders the array, so if any lane would annihilate nothing is written and
+ * FALSE returned, the scalar kernel then takes state i. Pair creation has
+ * side effects, those few quarks are handled in the scalar order before the
+ * forces read the moved positions. */
+#define BOUND_STATE_FORCES_SSE2(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)                                   \
+int NAME##_forces_sse2(Archetype* archetype, const int i, const unsigned int first){                            \
+        Particle_Array* particles = &archetype->particles;                                                      \
+        float* position_x = &particles->position_x[i*N];                                                        \
+        float* position_y = &particles->position_y[i*N];                                                        \
+        __m128 x[N], y[N];                                                                                      \
+        for(int j = 0; j < N; j++){                                                                             \
+                x[j] = load_strided(position_x + j, N);                                                         \
+                y[j] = load_strided(position_y + j, N);                                                         \
+        }                                                                                                       \
+                                                                                                                \
+        if(ANNIHILATE_DIST > 0){                                                                                \
+                const float annihilate_dist = ANNIHILATE_DIST;                                                  \
+                __m128 dx = _mm_sub_ps(x[0], x[1]);                                                             \
+                __m128 dy = _mm_sub_ps(y[0], y[1]);                                                             \
+                __m128 dist_squared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));                       \
+                __m128 close = _mm_cmple_ps(dist_squared, _mm_set1_ps(float_below(pow(annihilate_dist, 2))));   \
+                if(_mm_movemask_ps(close) != 0) return FALSE;                                                   \
+        }                                                                                                       \
+                                                                                                                \
+        /* Pair creation */                                                                                     \
+        if(MAX_DIST > 0){                                                                                       \
+                const float max_dist = MAX_DIST;                                                                \
+                __m128 mid_x = x[0];                                                                            \
+                __m128 mid_y = y[0];                                                                            \
+                for(int j = 1; j < N; j++){                                                                     \
+                        mid_x = _mm_add_ps(mid_x, x[j]);                                                        \
+                        mid_y = _mm_add_ps(mid_y, y[j]);                                                        \
+                }                                                                                               \
+                mid_x = _mm_div_ps(mid_x, _mm_set1_ps(N));                                                      \
+                mid_y = _mm_div_ps(mid_y, _mm_set1_ps(N));                                                      \
+                const __m128 max_squared = _mm_set1_ps(float_below(pow(max_dist, 2)));                          \
+                int strays = 0; /* Bit j*4 + lane */                                                            \
+                for(int j = 0; j < N; j++){                                                                     \
+                        __m128 dx = _mm_sub_ps(mid_x, x[j]);                                                    \
+                        __m128 dy = _mm_sub_ps(mid_y, y[j]);                                                    \
+                        __m128 dist_squared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));               \
+                        strays |= _mm_movemask_ps(_mm_cmpgt_ps(dist_squared, max_squared)) << j*4;              \
+                }                                                                                               \
+                if(strays != 0){                                                                                \
+                        float middle_x[4], middle_y[4];                                                         \
+                        _mm_storeu_ps(middle_x, mid_x);                                                         \
+                        _mm_storeu_ps(middle_y, mid_y);                                                         \
+                        for(int l = 0; l < 4; l++){                                                             \
+                                for(int j = 0; j < N; j++){                                                     \
+                                        if((strays >> (j*4 + l) & 1) == 0) continue;                            \
+                                        Particle part = particle_array_get(particles, (i + l)*N + j);           \
+                                        vec2 middle_middle = {(middle_x[l] + part.position[0])*0.5f,            \
+                                                              (middle_y[l] + part.position[1])*0.5f};           \
+                                        spawn_meson(part.position, part.velocity, middle_middle, part.velocity); \
+                                        position_x[l*N + j] = middle_middle[0];                                 \
+                                        position_y[l*N + j] = middle_middle[1];                                 \
+                                }                                                                               \
+                        }                                                                                       \
+                        for(int j = 0; j < N; j++){                                                             \
+                                x[j] = load_strided(position_x + j, N);                                         \
+                                y[j] = load_strided(position_y + j, N);                                         \
+                        }                                                                                       \
+                }                                                                                               \
+        }                                                                                                       \
+                                                                                                                \
+        /* Attraction forces between quarks, pairs closer than min_dist are masked out */                       \
+        const float min_dist = MIN_DIST;                                                                        \
+        const __m128 min_squared = _mm_set1_ps(float_below(pow(min_dist, 2)));                                  \
+        const __m128 force_mag = _mm_set1_ps(-FORCE_MULTIPLIER);                                                \
+        for(int j = 0; j < N; j++){                                                                             \
+                __m128 force_x = _mm_setzero_ps();                                                              \
+                __m128 force_y = _mm_setzero_ps();                                                              \
+                for(int k = 0; k < N - 1; k++){                                                                 \
+                        const int other = (j+1+k)%N;                                                            \
+                        __m128 dx = _mm_sub_ps(x[j], x[other]);                                                 \
+                        __m128 dy = _mm_sub_ps(y[j], y[other]);                                                 \
+                        __m128 far = _mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), min_squared); \
+                        force_x = _mm_add_ps(force_x, _mm_and_ps(far, _mm_mul_ps(dx, force_mag)));             \
+                        force_y = _mm_add_ps(force_y, _mm_and_ps(far, _mm_mul_ps(dy, force_mag)));             \
+                }                                                                                               \
+                store_strided(&forces.x[i*N + j - first], N, force_x);                                          \
+                store_strided(&forces.y[i*N + j - first], N, force_y);                                          \
+        }                                                                                                       \
+        return TRUE;                                                                                            \
+}
+#else
+#define BOUND_STATE_FORCES_SSE2(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)
+#endif
+
+#if defined(__AVX__)
+// load_strided and store_strided for 8 bound states
+__m256 load_strided8(const float* base, const int stride){
+        return _mm256_set_ps(base[7*stride], base[6*stride], base[5*stride], base[4*stride],
+                             base[3*stride], base[2*stride], base[stride], base[0]);
+}
+
+void store_strided8(float* base, const int stride, const __m256 value){
+        float lanes[8];
+        _mm256_storeu_ps(lanes, value);
+        for(int l = 0; l < 8; l++) base[l*stride] = lanes[l];
+}
+
+// NAME_forces_sse2 for bound states i to i+7
+#define BOUND_STATE_FORCES_AVX(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)                                    \
+int NAME##_forces_avx(Archetype* archetype, const int i, const unsigned int first){                             \
+        Particle_Array* particles = &archetype->particles;                                                      \
+        float* position_x = &particles->position_x[i*N];                                                        \
+        float* position_y = &particles->position_y[i*N];                                                        \
+        __m256 x[N], y[N];                                                                                      \
+        for(int j = 0; j < N; j++){                                                                             \
+                x[j] = load_strided8(position_x + j, N);                                                        \
+                y[j] = load_strided8(position_y + j, N);                                                        \
+        }                                                                                                       \
+                                                                                                                \
+        if(ANNIHILATE_DIST > 0){                                                                                \
+                const float annihilate_dist = ANNIHILATE_DIST;                                                  \
+                __m256 dx = _mm256_sub_ps(x[0], x[1]);                                                          \
+                __m256 dy = _mm256_sub_ps(y[0], y[1]);                                                          \
+                __m256 dist_squared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));              \
+                __m256 close = _mm256_cmp_ps(dist_squared, _mm256_set1_ps(float_below(pow(annihilate_dist, 2))), _CMP_LE_OQ); \
+                if(_mm256_movemask_ps(close) != 0) return FALSE;                                                \
+        }                                                                                                       \
+                                                                                                                \
+        /* Pair creation */                                                                                     \
+        if(MAX_DIST > 0){                                                                                       \
+                const float max_dist = MAX_DIST;                                                                \
+                __m256 mid_x = x[0];                                                                            \
+                __m256 mid_y = y[0];                                                                            \
+                for(int j = 1; j < N; j++){                                                                     \
+                        mid_x = _mm256_add_ps(mid_x, x[j]);                                                     \
+                        mid_y = _mm256_add_ps(mid_y, y[j]);                                                     \
+                }                                                                                               \
+                mid_x = _mm256_div_ps(mid_x, _mm256_set1_ps(N));                                                \
+                mid_y = _mm256_div_ps(mid_y, _mm256_set1_ps(N));                                                \
+                const __m256 max_squared = _mm256_set1_ps(float_below(pow(max_dist, 2)));                       \
+                int strays[N]; /* Lane bits of each quark */                                                    \
+                int any = 0;                                                                                    \
+                for(int j = 0; j < N; j++){                                                                     \
+                        __m256 dx = _mm256_sub_ps(mid_x, x[j]);                                                 \
+                        __m256 dy = _mm256_sub_ps(mid_y, y[j]);                                                 \
+                        __m256 dist_squared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));      \
+                        strays[j] = _mm256_movemask_ps(_mm256_cmp_ps(dist_squared, max_squared, _CMP_GT_OQ));   \
+                        any |= strays[j];                                                                       \
+                }                                                                                               \
+                if(any != 0){                                                                                   \
+                        float middle_x[8], middle_y[8];                                                         \
+                        _mm256_storeu_ps(middle_x, mid_x);                                                      \
+                        _mm256_storeu_ps(middle_y, mid_y);                                                      \
+                        for(int l = 0; l < 8; l++){                                                             \
+                                for(int j = 0; j < N; j++){                                                     \
+                                        if((strays[j] >> l & 1) == 0) continue;                                 \
+                                        Particle part = particle_array_get(particles, (i + l)*N + j);           \
+                                        vec2 middle_middle = {(middle_x[l] + part.position[0])*0.5f,            \
+                                                              (middle_y[l] + part.position[1])*0.5f};           \
+                                        spawn_meson(part.position, part.velocity, middle_middle, part.velocity); \
+                                        position_x[l*N + j] = middle_middle[0];                                 \
+                                        position_y[l*N + j] = middle_middle[1];                                 \
+                                }                                                                               \
+                        }                                                                                       \
+                        for(int j = 0; j < N; j++){                                                             \
+                                x[j] = load_strided8(position_x + j, N);                                        \
+                                y[j] = load_strided8(position_y + j, N);                                        \
+                        }                                                                                       \
+                }                                                                                               \
+        }                                                                                                       \
+                                                                                                                \
+        /* Attraction forces between quarks, pairs closer than min_dist are masked out */                       \
+        const float min_dist = MIN_DIST;                                                                        \
+        const __m256 min_squared = _mm256_set1_ps(float_below(pow(min_dist, 2)));                               \
+        const __m256 force_mag = _mm256_set1_ps(-FORCE_MULTIPLIER);                                             \
+        for(int j = 0; j < N; j++){                                                                             \
+                __m256 force_x = _mm256_setzero_ps();                                                           \
+                __m256 force_y = _mm256_setzero_ps();                                                           \
+                for(int k = 0; k < N - 1; k++){                                                                 \
+                        const int other = (j+1+k)%N;                                                            \
+                        __m256 dx = _mm256_sub_ps(x[j], x[other]);                                              \
+                        __m256 dy = _mm256_sub_ps(y[j], y[other]);                                              \
+                        __m256 far = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), \
+                                                   min_squared, _CMP_GT_OQ);                                    \
+                        force_x = _mm256_add_ps(force_x, _mm256_and_ps(far, _mm256_mul_ps(dx, force_mag)));    \
+                        force_y = _mm256_add_ps(force_y, _mm256_and_ps(far, _mm256_mul_ps(dy, force_mag)));    \
+                }                                                                                               \
+                store_strided8(&forces.x[i*N + j - first], N, force_x);                                         \
+                store_strided8(&forces.y[i*N + j - first], N, force_y);                                         \
+        }                                                                                                       \
+        return TRUE;                                                                                            \
+}
+#else
+#define BOUND_STATE_FORCES_AVX(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)
+#endif
+
+/* The widest kernel the build has goes first. Under AVX the SSE2 one takes
+ * 4 states that are left or that the 8 lane kernel handed back. */
+#if defined(__AVX__)
+#define BOUND_STATE_LANES 8
+#define BOUND_STATE_FORCES_LANES(NAME, archetype, i, first) NAME##_forces_avx(archetype, i, first)
+#define BOUND_STATE_FORCES_HALF(NAME, archetype, i, first) NAME##_forces_sse2(archetype, i, first)
+#elif defined(__SSE2__)
+#define BOUND_STATE_LANES 4
+#define BOUND_STATE_FORCES_LANES(NAME, archetype, i, first) NAME##_forces_sse2(archetype, i, first)
+#define BOUND_STATE_FORCES_HALF(NAME, archetype, i, first) FALSE
+#else
+#define BOUND_STATE_LANES 4
+#define BOUND_STATE_FORCES_LANES(NAME, archetype, i, first) FALSE
+#define BOUND_STATE_FORCES_HALF(NAME, archetype, i, first) FALSE
+#endif
+
+/* The archetype's system. Annihilations shrink the array, the last state
+ * moves into the hole from a later chunk. */
+#define BOUND_STATE_UPDATE(NAME, N)                                                                             \
+void update_##NAME(Archetype* archetype, unsigned int begin, unsigned int end, float delta_time){               \
+        Particle_Array* particles = &archetype->particles;                                                      \
+        for(unsigned int first = begin; first < end && first < particles->size; first += FUSED_CHUNK){          \
+                unsigned int last = first + FUSED_CHUNK < end ? first + FUSED_CHUNK : end;                      \
+                for(int i = first/N; i*N < last && i*N < particles->size;){                                     \
+                        if((i + BOUND_STATE_LANES)*N <= last && (i + BOUND_STATE_LANES)*N <= particles->size && \
+                           BOUND_STATE_FORCES_LANES(NAME, archetype, i, first)){                                \
+                                i += BOUND_STATE_LANES;                                                         \
+                                continue;                                                                       \
+                        }                                                                                       \
+                        if(BOUND_STATE_LANES > 4 && (i + 4)*N <= last && (i + 4)*N <= particles->size &&        \
+                           BOUND_STATE_FORCES_HALF(NAME, archetype, i, first)){                                 \
+                                i += 4;                                                                         \
+                                continue;                                                                       \
+                        }                                                                                       \
+                        if(NAME##_force(archetype, i, first)) i++;                                              \
+                }                                                                                               \
+                if(last > particles->size) last = particles->size;                                              \
+                if(last > first) integrate_chunk(particles, first, last, delta_time);                           \
+        }                                                                                                       \
+}
+
+#define BOUND_STATE_KERNELS(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)      \
+        BOUND_STATE_FORCE(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)        \
+        BOUND_STATE_FORCES_SSE2(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)  \
+        BOUND_STATE_FORCES_AVX(NAME, N, ANNIHILATE_DIST, MAX_DIST, MIN_DIST)   \
+        BOUND_STATE_UPDATE(NAME, N)
+
+// New hadrons need a line here and an archetype_register with update_NAME, see init_exotic_archetypes
+BOUND_STATE_KERNELS(mesons,      2, 0.05, 0,   0)
+BOUND_STATE_KERNELS(baryons,     3, 0,    0.2, 0.055)
+BOUND_STATE_KERNELS(tetraquarks, 4, 0,    0.2, 0.055)
+BOUND_STATE_KERNELS(pentaquarks, 5, 0,    0.2, 0.055)
+
+// Spreads the low 16 bits to the even bits
+uint32_t morton_spread(uint32_t v){
+        v &= 0xFFFF;
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+}
+
+// Z-order curve index of a position, 16 bits per axis over the box; outside it clamps to the edge
+uint32_t morton_code(float x, float y){
+        x = fminf(fmaxf((x + 1.0f)*0.5f, 0.0f), 1.0f);
+        y = fminf(fmaxf((y + 1.0f)*0.5f, 0.0f), 1.0f);
+        return morton_spread((uint32_t)(x*65535.0f)) | (morton_spread((uint32_t)(y*65535.0f)) << 1);
+}
+
+// Slot i of the column takes what was in slot source[i], through scratch
+void permute_column(void* column, const size_t element, const uint32_t* source, const unsigned int count, void* scratch){
+        switch(element){
+                case sizeof(uint16_t):
+                        for(unsigned int i = 0; i < count; i++) ((uint16_t*)scratch)[i] = ((const uint16_t*)column)[source[i]];
+                        break;
+                case sizeof(uint32_t):
+                        for(unsigned int i = 0; i < count; i++) ((uint32_t*)scratch)[i] = ((const uint32_t*)column)[source[i]];
+                        break;
+                case sizeof(uint64_t):
+                        for(unsigned int i = 0; i < count; i++) ((uint64_t*)scratch)[i] = ((const uint64_t*)column)[source[i]];
+                        break;
+                default:
+                        printf("ERROR: No permute for %zu byte columns\n", element);
+                        exit(1);
+        }
+        memcpy(column, scratch, element*count);
+}
+
+/* Reorders the archetype's bound states along a Z-order curve of their
+ * first particle, so particles close in the box are close in memory. Groups
+ * move whole, so hadrons keep their quarks in place, and the handle table
+ * is pointed at the new slots. Scratch comes from the frame arena; when it
+ * does not fit the sort is skipped. */
+void morton_sort(Archetype* archetype){
+        Particle_Array* particles = &archetype->particles;
+        const unsigned int group = archetype->group;
+        const unsigned int groups = particles->size/group;
+        if(groups < 2) return;
+        const size_t needed = sizeof(uint32_t)*4*groups + (sizeof(uint32_t) + sizeof(Particle_Handle))*particles->size +
+                              6*ARENA_ALIGNMENT;
+        if(arena_available(&frame_arena) < needed) return;
+
+        const Uint64 start = SDL_GetPerformanceCounter();
+        uint32_t* keys    = (uint32_t*)arena_alloc(&frame_arena, sizeof(uint32_t)*groups);
+        uint32_t* order   = (uint32_t*)arena_alloc(&frame_arena, sizeof(uint32_t)*groups);
+        uint32_t* keys2   = (uint32_t*)arena_alloc(&frame_arena, sizeof(uint32_t)*groups);
+        uint32_t* order2  = (uint32_t*)arena_alloc(&frame_arena, sizeof(uint32_t)*groups);
+        uint32_t* source  = (uint32_t*)arena_alloc(&frame_arena, sizeof(uint32_t)*particles->size);
+        void* scratch     = arena_alloc(&frame_arena, sizeof(Particle_Handle)*particles->size);
+        for(unsigned int g = 0; g < groups; g++){
+                keys[g]  = morton_code(particles->position_x[g*group], particles->position_y[g*group]);
+                order[g] = g;
         }
+        int threads = SDL_GetCPUCount();
+        radix_sort_pairs(keys, order, keys2, order2, groups, threads > 0 ? threads : 1);
 
-        // UPDATE POSITIONS
-        for(int i = 0; i < baryons.size; i++){
-                Particle part1 = baryons.particle[i];
-                baryons.particle[i].position[0] += baryons.particle[i].velocity[0]*delta_time;
-                baryons.particle[i].position[1] += baryons.particle[i].velocity[1]*delta_time;
+        // Whole groups move, each keeps its particles in order
+        for(unsigned int g = 0; g < groups; g++){
+                for(unsigned int j = 0; j < group; j++) source[g*group + j] = order[g]*group + j;
         }
-        // BOUNDARIES
-        check_boundaries(baryons);
-}
-
-void update_mesons(float delta_time){
-        if(mesons.size % 2 != 0) exit(1); // Mesons need 2 quarks
-
-        vec2 force[] = {{0.0f, 0.0f}, {0.0f, 0.0f}};
-        for(int i = 0; i < mesons.size/2; i++){
-                Particle part[2];
-                part[0] = mesons.particle[i*2];
-                part[1] = mesons.particle[i*2 + 1];
-
-                // Meson annihilation
-                float dist_squared = glm_vec2_distance2(part[0].position, part[1].position);
-                float min_dist = 0.05;
-                if(dist_squared <= pow(min_dist,2)){
-                        vec2 new_vel = {part[0].velocity[1], -part[0].velocity[0]};
-                        vec2 new_vel2 = {-part[0].velocity[1], part[0].velocity[0]};
-                        spawn_photon(part[0].position, new_vel);
-                        spawn_photon(part[0].position, new_vel2);
-                        remove_meson(i);
-                        continue;
-                }
+        const unsigned int size = particles->size;
+        permute_column(particles->position_x, sizeof(float), source, size, scratch);
+        permute_column(particles->position_y, sizeof(float), source, size, scratch);
+        permute_column(particles->velocity_x, sizeof(float), source, size, scratch);
+        permute_column(particles->velocity_y, sizeof(float), source, size, scratch);
+        permute_column(particles->descriptor, sizeof(Particle_Descriptor), source, size, scratch);
+        permute_column(particles->handle, sizeof(Particle_Handle), source, size, scratch);
+        for(unsigned int i = 0; i < particles->size; i++)
+                particles->handles.slot[particle_handle_index(particles->handle[i])] = i;
+
+        sort_report.name   = archetype->name;
+        sort_report.groups = groups;
+        sort_report.ms     = (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency();
+        sort_report.before = (double)archetype->cost/particles->size;
+        sort_report.after  = -1.0;
+        sort_report.sorts++;
+}
 
-                vec2 forceDir;
-                glm_vec2_sub(part[0].position, part[1].position, forceDir);
-                glm_vec2_norm(forceDir);
-
-                float forceMag = -FORCE_MULTIPLIER;
-
-                glm_vec2_scale(forceDir, forceMag, forceDir);
-                glm_vec2_add(force[0], forceDir, force[0]);
-                glm_vec2_sub(force[1], forceDir, force[1]);
-
-                for(int j = 0; j < 2; j++){
-                        // Drag
-                        vec2 drag = {0.0f, 0.0f};
-                        glm_vec2_copy(part[j].velocity, drag);
-                        glm_vec2_negate(drag);
-                        glm_vec2_scale(drag, 0.1, drag);
-                        glm_vec2_add(force[j], drag, force[j]);
-
-                        // UPDATE VELOCITIES
-                        glm_vec2_scale(force[j], delta_time, force[j]);
-                        glm_vec2_add(part[j].velocity, force[j], part[j].velocity); 
-
-                        // Max Velocity
-                        float mag_squared = glm_vec2_norm2(part[j].velocity);
-                        if(mag_squared > pow(SPEED_OF_C,2)){
-                                glm_vec2_normalize(part[j].velocity);
-                                glm_vec2_scale(part[j].velocity, SPEED_OF_C, part[j].velocity);
-                        }
-                }
-                mesons.particle[i*2]     = part[0];
-                mesons.particle[i*2 + 1] = part[1];
+// Registration order is the order the systems run in
+void init_archetypes(){
+        photons = archetype_register("photons", PHOTON,   1, MAX_PHOTONS,       update_photons);
+        baryons = archetype_register("baryons", QUARK_UP, 3, MAX_BARYON_QUARKS, update_baryons);
+        mesons  = archetype_register("mesons",  QUARK_UP, 2, MAX_MESON_QUARKS,  update_mesons);
+}
+
+// Off by default, they run after the three above
+void init_exotic_archetypes(){
+        tetraquarks = archetype_register("tetraquarks", QUARK_UP, 4, MAX_EXOTIC_QUARKS, update_tetraquarks);
+        pentaquarks = archetype_register("pentaquarks", QUARK_UP, 5, MAX_EXOTIC_QUARKS, update_pentaquarks);
+}
+
+void spawn_initial(){
+        for(unsigned int i = 0; i < initial_baryons; i++) spawn_baryon();
+        if(tetraquarks == NULL) return;
+        for(unsigned int i = 0; i < initial_exotics; i++){
+                spawn_exotic(tetraquarks);
+                spawn_exotic(pentaquarks);
         }
+}
 
-        // UPDATE POSITIONS
-        for(int i = 0; i < mesons.size; i++){
-                Particle part1 = mesons.particle[i];
-                mesons.particle[i].position[0] += mesons.particle[i].velocity[0]*delta_time;
-                mesons.particle[i].position[1] += mesons.particle[i].velocity[1]*delta_time;
+/* Systems see PARTICLE_TILE particles per call, so a mapped store streams
+ * through memory: the next tile is read ahead and the finished one given
+ * back to the kernel. */
+void run_systems(float delta_time){
+        force_columns_alloc(&forces, FUSED_CHUNK);
+        // One archetype per interval, so no single step pays for sorting everything
+        Archetype* sorted = NULL;
+        if(sort_interval != 0 && archetype_count != 0 && ++sort_step % sort_interval == 0){
+                sorted = &archetypes[sort_next++ % archetype_count];
+                morton_sort(sorted);
+        }
+        for(unsigned int a = 0; a < archetype_count; a++){
+                Archetype* archetype = &archetypes[a];
+                Particle_Array* particles = &archetype->particles;
+                if(particles->size % archetype->group != 0){
+                        printf("ERROR: %s has a partial bound state\n", archetype->name);
+                        exit(1);
+                }
+                if(archetype->system == NULL) continue;
+                cache_counter_start(&cache_counter);
+                for(unsigned int begin = 0; begin < particles->size; begin += PARTICLE_TILE){
+                        unsigned int end = begin + PARTICLE_TILE;
+                        if(end > particles->size) end = particles->size;
+                        particle_array_advise(particles, end, end + PARTICLE_TILE, MADV_WILLNEED);
+                        archetype->system(archetype, begin, end, delta_time);
+                        particle_array_advise(particles, begin, end, MADV_DONTNEED);
+                }
+                archetype->cost = cache_counter_stop(&cache_counter);
+                if(archetype == sorted && particles->size != 0)
+                        sort_report.after = (double)archetype->cost/particles->size;
         }
-        // BOUNDARIES
-        check_boundaries(mesons);
 }
 
-void update(){
+void print_sort_report(){
+        if(sort_report.sorts == 0 || sort_report.after < 0.0) return;
+        printf("Morton sort %u, %s: %u groups in %.2f ms, %s per particle %.3f -> %.3f\n", sort_report.sorts,
+               sort_report.name, sort_report.groups, sort_report.ms, cache_counter_unit(&cache_counter),
+               sort_report.before, sort_report.after);
+}
+
+/* Reserve for frame_arena that holds a frame at particle_limit: the Morton
+ * sort's keys, orders, source slots and handle scratch, the cull lists and
+ * the density grids, each with its alignment. */
+size_t frame_arena_size(){
+        const size_t per_particle = 4*sizeof(uint32_t) + sizeof(uint32_t) + sizeof(Particle_Handle) + sizeof(unsigned int);
+        const size_t grids = sizeof(float)*4*LOD_GRID_WIDTH*LOD_GRID_HEIGHT*LOD_MAX_THREADS;
+        const size_t fixed = sizeof(float)*2*FUSED_CHUNK + MAX_ARCHETYPES*(4*sizeof(unsigned int) + 2*ARENA_ALIGNMENT) +
+                             16*ARENA_ALIGNMENT;
+        const size_t size = per_particle*particle_limit + grids + fixed;
+        return size > FRAME_ARENA_SIZE ? size : FRAME_ARENA_SIZE;
+}
 
-        int wait_time = FRAME_TARGET_TIME - (SDL_GetTicks() - last_frame_time);
-        if(wait_time > 0 && wait_time <= FRAME_TARGET_TIME)
-                SDL_Delay(wait_time);
+unsigned int count_particles(const Descriptor_Filter filter){
+        unsigned int count = 0;
+        for(unsigned int i = 0; i < archetype_count; i++)
+                count += count_matching(&archetypes[i].particles, filter);
+        return count;
+}
+
+void print_stats(){
+        printf("Particles: %u visible, %u culled\n", cull_visible, cull_culled);
+        printf("Quarks: %u (%u anti), leptons: %u\n", count_particles(filter_quarks),
+               count_particles(filter_antiquarks), count_particles(filter_leptons));
+        printf("Frame arena: %zu KB high water\n", frame_arena.high_water/1024);
+        print_sort_report();
+        printf("Budget (%s): %u/%u particles\n", budget_policy_name(budget_policy), particle_total(), particle_limit);
+        for(unsigned int i = 0; i < archetype_count; i++){
+                Particle_Budget* budget = &archetypes[i].budget;
+                printf("  %s: %u/%u particles, %u dropped, %u merged, %u throttled\n", archetypes[i].name,
+                       archetypes[i].particles.size, budget->limit, budget->dropped, budget->merged, budget->throttled);
+                budget->dropped = budget->merged = budget->throttled = 0;
+        }
+        printf("Frames (%s): %u, mean %.2f ms, stddev %.3f ms, worst %.2f ms, missed %u\n",
+               frame_pace_mode_name(pacer.mode), pacer.frames, pacer.mean_ms,
+               frame_pacer_stddev_ms(&pacer), pacer.worst_ms, pacer.missed);
+        frame_pacer_reset_stats(&pacer);
+        fflush(stdout);
+}
 
-        float delta_time = (SDL_GetTicks() - last_frame_time) / 1000.0f;
+void update(){
+        arena_reset(&frame_arena);
+        float delta_time = frame_pacer_wait(&pacer);
         last_frame_time = SDL_GetTicks();
 
         float currentTime = SDL_GetTicks();
         if(currentTime - lastTime >= 1*1000.0f){
                 lastTime = currentTime;
+                if(show_stats == TRUE) print_stats();
                 float v1 = ((rand() % 98)-49)/50.0f;
                 float v2 = ((rand() % 98)-49)/50.0f;
                 float p1 = ((rand() % 98)-49)/50.0f;
                 float p2 = ((rand() % 98)-49)/50.0f;
                 //spawn_meson((vec2){p1,p2}, (vec2){v1,v2}, (vec2){v1,v2}, (vec2){p1,p2});
                 //spawn_baryon();
-                //spawn_particle(&photons, PHOTON, 0, (vec2){0.0f,0.0f}, (vec2){10.0f,10.0f});
+                //spawn_particle(&photons->particles, photons->particles.size, PHOTON, 0, COLOUR_NONE, (vec2){0.0f,0.0f}, (vec2){10.0f,10.0f});
         }
 
         if(delta_time > 0.05) return;
         delta_time *= 1;
-        update_photons(delta_time);
-        update_baryons(delta_time);
-        update_mesons(delta_time);
+        if(turbulence == TRUE){
+                turbulence_offset[0] = fmodf(turbulence_offset[0] + TURBULENCE_DRIFT*delta_time, TURBULENCE_PERIOD);
+                turbulence_offset[1] = fmodf(turbulence_offset[1] + 0.5f*TURBULENCE_DRIFT*delta_time, TURBULENCE_PERIOD);
+        }
+        run_systems(delta_time);
+
+}
+
+/* Spring towards the centre of the box, a stand in for the strong force in
+ * --benchmark. Cheap on purpose, so the passes around it are what gets timed. */
+void benchmark_force(const float x, const float y, vec2 force){
+        force[0] = -FORCE_MULTIPLIER*x;
+        force[1] = -FORCE_MULTIPLIER*y;
+}
+
+// A force pass over the whole array, then one pass per step of the integration
+void benchmark_column_passes(Particle_Array* particles, const float delta_time){
+        for(unsigned int i = 0; i < particles->size; i++){
+                vec2 force;
+                benchmark_force(particles->position_x[i], particles->position_y[i], force);
+                forces.x[i] = force[0];
+                forces.y[i] = force[1];
+        }
+        integrate_particles(particles, delta_time);
+        check_boundaries(*particles);
+}
+
+// The same passes a PARTICLE_TILE at a time
+void benchmark_tiled_passes(Particle_Array* particles, const float delta_time){
+        const Force_Columns all = forces;
+        for(unsigned int begin = 0; begin < particles->size; begin += PARTICLE_TILE){
+                unsigned int end = begin + PARTICLE_TILE;
+                if(end > particles->size) end = particles->size;
+                Particle_Array tile = particle_array_tile(particles, begin, end);
+                forces.x = all.x + begin;
+                forces.y = all.y + begin;
+                benchmark_column_passes(&tile, delta_time);
+        }
+        forces = all;
+}
+
+// Force loop and passes a FUSED_CHUNK at a time, as the bound state systems do
+void benchmark_fused_pass(Particle_Array* particles, const float delta_time){
+        for(unsigned int first = 0; first < particles->size; first += FUSED_CHUNK){
+                const unsigned int last = first + FUSED_CHUNK < particles->size ? first + FUSED_CHUNK : particles->size;
+                for(unsigned int i = first; i < last; i++){
+                        vec2 force;
+                        benchmark_force(particles->position_x[i], particles->position_y[i], force);
+                        forces.x[i - first] = force[0];
+                        forces.y[i - first] = force[1];
+                }
+                integrate_chunk(particles, first, last, delta_time);
+        }
+}
+
+/* --benchmark[=N]: N particles through the column passes, the tiled passes
+ * and the fused pass, each BENCHMARK_RUNS times from the same start. Past
+ * the caches the passes are bound by memory traffic, so the time per
+ * particle shows what fusing saves. */
+int run_benchmark(const unsigned int count){
+        if(SDL_Init(SDL_INIT_TIMER) != 0){
+                printf("SDL2 could not initialize the timer subsystem\n");
+                exit(1);
+        }
+        Particle_Array particles = {0};
+        Particle_Array start = {0};
+        particle_array_reserve(&particles, count);
+        for(unsigned int i = 0; i < count; i++){
+                Particle particle;
+                particle.position[0] = ((rand() % 2000)-1000)/1000.0f;
+                particle.position[1] = ((rand() % 2000)-1000)/1000.0f;
+                particle.velocity[0] = ((rand() % 2000)-1000)/1000.0f;
+                particle.velocity[1] = ((rand() % 2000)-1000)/1000.0f;
+                particle.descriptor = make_descriptor(QUARK_UP, FALSE, COLOUR_RED);
+                particle_array_push(&particles, particle);
+        }
+        particle_array_reserve(&start, count);
+        for(unsigned int i = 0; i < count; i++) particle_array_set(&start, i, particle_array_get(&particles, i));
+        // Column passes need forces for every particle, past any frame arena for large counts
+        forces.x = (float*)malloc(sizeof(float)*count);
+        forces.y = (float*)malloc(sizeof(float)*count);
+        forces.capacity = count;
+        if(forces.x == NULL || forces.y == NULL){
+                printf("ERROR: Could not allocate forces for %u particles\n", count);
+                exit(1);
+        }
+
+        void (*kernels[])(Particle_Array*, const float) = {benchmark_column_passes, benchmark_tiled_passes, benchmark_fused_pass};
+        const char* names[] = {"column passes", "tiled passes", "fused pass"};
+        const double frequency = SDL_GetPerformanceFrequency();
+        double ns[3];
+        printf("Benchmark: %u particles, best of %d runs\n", count, BENCHMARK_RUNS);
+        for(int k = 0; k < 3; k++){
+                double best = 0.0;
+                uint64_t best_cost = 0;
+                for(int run = 0; run < BENCHMARK_RUNS; run++){
+                        for(unsigned int i = 0; i < count; i++) particle_array_set(&particles, i, particle_array_get(&start, i));
+                        cache_counter_start(&cache_counter);
+                        const Uint64 begin = SDL_GetPerformanceCounter();
+                        kernels[k](&particles, 1.0f/TARGET_FPS);
+                        const double elapsed = (SDL_GetPerformanceCounter() - begin)*1e9/frequency;
+                        const uint64_t cost = cache_counter_stop(&cache_counter);
+                        if(run == 0 || elapsed < best){
+                                best = elapsed;
+                                best_cost = cost;
+                        }
+                }
+                ns[k] = best/count;
+                printf("  %-14s %.2f ns per particle", names[k], ns[k]);
+                if(cache_counter.hardware) printf(", %.3f cache misses", (double)best_cost/count);
+                printf("\n");
+        }
+        printf("Fused pass is %.2fx the column passes and %.2fx the tiled passes\n", ns[0]/ns[2], ns[1]/ns[2]);
+        free(forces.x);
+        free(forces.y);
+        memset(&forces, 0, sizeof(forces));
+        particle_array_free(&particles);
+        particle_array_free(&start);
+        SDL_Quit();
+        return 0;
+}
 
+/* Fixed time steps as fast as they run, for parameter studies too large to
+ * draw. No SDL video or GL, and the seed is fixed so runs repeat. */
+int run_headless(){
+        if(SDL_Init(SDL_INIT_TIMER) != 0){
+                printf("SDL2 could not initialize the timer subsystem\n");
+                exit(1);
+        }
+        spawn_initial();
+
+        const float delta_time = 1.0f/TARGET_FPS;
+        const Uint64 frequency = SDL_GetPerformanceFrequency();
+        const Uint64 start = SDL_GetPerformanceCounter();
+        Uint64 last = start;
+        unsigned int sorts_reported = 0;
+        for(unsigned int step = 1; step <= headless_steps; step++){
+                arena_reset(&frame_arena);
+                run_systems(delta_time);
+                if(step % TARGET_FPS == 0 || step == headless_steps){
+                        const Uint64 now = SDL_GetPerformanceCounter();
+                        const unsigned int steps = step % TARGET_FPS == 0 ? TARGET_FPS : step % TARGET_FPS;
+                        printf("Step %u/%u: %u particles, %.2f ms per step\n", step, headless_steps,
+                               particle_total(), (now - last)*1000.0/frequency/steps);
+                        if(sort_report.sorts != sorts_reported) print_sort_report();
+                        sorts_reported = sort_report.sorts;
+                        fflush(stdout);
+                        last = now;
+                }
+        }
+        const double seconds = (double)(SDL_GetPerformanceCounter() - start)/frequency;
+        printf("%u steps in %.2f s, frame arena %zu KB high water\n", headless_steps, seconds, frame_arena.high_water/1024);
+        for(unsigned int i = 0; i < archetype_count; i++)
+                printf("  %s: %u particles%s\n", archetypes[i].name, archetypes[i].particles.size,
+                       archetypes[i].particles.store != NULL ? ", mapped" : "");
+        SDL_Quit();
+        return 0;
 }
 
 typedef struct{
@@ -642,26 +2412,80 @@ typedef struct{
 
 
 void draw(){
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        if(trails == TRUE){
+                glBindFramebuffer(GL_FRAMEBUFFER, trailFBO);
+                fade_trails();
+        }else{
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
 
         glDepthMask(GL_FALSE); // Disable for particles because it shows their triangles
-        for(int i = 0; i < baryons.size; i++){
-                draw_particle(baryons.particle[i], i);
-        }
-        for(int i = 0; i < photons.size; i++){
-                draw_particle(photons.particle[i], i);
-        }
-        for(int i = 0; i < mesons.size; i++){
-                draw_particle(mesons.particle[i], i);
+        upload_static_meshes(MESH_UPLOAD_BYTES);
+        draw_static_meshes();
+        // Only what is on screen is drawn, and the LOD choice follows what is visible
+        const View_Bounds bounds = get_view_bounds(PARTICLE_RADIUS);
+        cull_visible = 0;
+        for(unsigned int a = 0; a < archetype_count; a++)
+                cull_visible += cull_particles(&archetypes[a].particles, bounds, &archetypes[a].visible);
+        cull_culled = particle_total() - cull_visible;
+        if(cull_visible > lod_threshold){
+                draw_density();
+        }else{
+                for(unsigned int a = 0; a < archetype_count; a++){
+                        const Particle_Array* particles = &archetypes[a].particles;
+                        for(int i = 0; i < archetypes[a].visible.size; i++){
+                                unsigned int index = archetypes[a].visible.index[i];
+                                draw_particle(particle_array_get(particles, index), particle_handle_index(particles->handle[index]));
+                        }
+                }
         }
         glDepthMask(GL_TRUE);
+
+        if(trails == TRUE){
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                blit_trails();
+        }
         SDL_GL_SwapWindow(glWindow);
 }
 
 int main(int argc, char** argv) {
+        init_archetypes();
+
+        // Every argument is an OBJ file of static scene geometry, options first
+        for(int i = 1; i < argc; i++){
+                if(strcmp(argv[i], "--no-optimize") == 0) mesh_flags &= ~OBJ_MESH_OPTIMIZE;
+                if(strcmp(argv[i], "--headless") == 0)    headless = TRUE;
+                if(strcmp(argv[i], "--benchmark") == 0)   benchmark = BENCHMARK_PARTICLES;
+                if(strncmp(argv[i], "--benchmark=", 12) == 0)     benchmark             = strtoul(argv[i] + 12, NULL, 10);
+                if(strncmp(argv[i], "--steps=", 8) == 0)          headless_steps        = strtoul(argv[i] + 8, NULL, 10);
+                if(strncmp(argv[i], "--baryons=", 10) == 0)       initial_baryons       = strtoul(argv[i] + 10, NULL, 10);
+                if(strncmp(argv[i], "--exotics=", 10) == 0)       initial_exotics       = strtoul(argv[i] + 10, NULL, 10);
+                if(strncmp(argv[i], "--store=", 8) == 0)          store_directory       = argv[i] + 8;
+                if(strncmp(argv[i], "--sort-interval=", 16) == 0) sort_interval         = strtoul(argv[i] + 16, NULL, 10);
+                if(strncmp(argv[i], "--max-particles=", 16) == 0) particle_limit        = strtoul(argv[i] + 16, NULL, 10);
+                if(strncmp(argv[i], "--lod-threshold=", 16) == 0) lod_threshold         = strtoul(argv[i] + 16, NULL, 10);
+                if(strncmp(argv[i], "--max-baryons=", 14) == 0)   baryons->budget.limit = strtoul(argv[i] + 14, NULL, 10)*baryons->group;
+                if(strncmp(argv[i], "--max-mesons=", 13) == 0)    mesons->budget.limit  = strtoul(argv[i] + 13, NULL, 10)*mesons->group;
+                if(strncmp(argv[i], "--max-photons=", 14) == 0)   photons->budget.limit = strtoul(argv[i] + 14, NULL, 10);
+                for(int policy = 0; policy < BUDGET_POLICY_COUNT; policy++){
+                        if(strncmp(argv[i], "--budget=", 9) == 0 && strcmp(argv[i] + 9, budget_policy_name(policy)) == 0)
+                                budget_policy = policy;
+                }
+        }
+        if(initial_exotics != 0) init_exotic_archetypes();
+        arena_init(&frame_arena, frame_arena_size());
+        if(store_directory != NULL){
+                for(unsigned int i = 0; i < archetype_count; i++)
+                        particle_array_map(&archetypes[i].particles, store_directory, archetypes[i].name);
+        }
+        init_budgets();
+        cache_counter_init(&cache_counter);
+        if(benchmark != 0) return run_benchmark(benchmark);
+        if(headless == TRUE) return run_headless();
+
         if(SDL_Init(SDL_INIT_EVERYTHING) != 0){
                 printf("SDL2 could not initialize video subsystem\n");
                 exit(1);
@@ -697,6 +2521,16 @@ int main(int argc, char** argv) {
         int counter = 0;
 
         init();
+        frame_pacer_init(&pacer, FRAME_PACE_VSYNC, TARGET_FPS);
+        for(int i = 1; i < argc; i++){
+                if(strncmp(argv[i], "--", 2) == 0) continue;
+                if(mesh_file_count == MAX_MESHES){
+                        printf("ERROR: More than %d meshes, %s skipped\n", MAX_MESHES, argv[i]);
+                        continue;
+                }
+                mesh_files[mesh_file_count++] = argv[i];
+        }
+        obj_load_async(&mesh_load, mesh_files, mesh_file_count, mesh_flags);
 
         /**
         ctx = nk_sdl_init(glWindow);
@@ -705,9 +2539,7 @@ int main(int argc, char** argv) {
         nk_sdl_font_stash_end();}
         **/
 
-        for(int i = 0; i < 10; i++){
-                spawn_baryon();
-        }
+        spawn_initial();
 
         while(quit == FALSE){
                 input(&quit);
@@ -719,6 +2551,8 @@ int main(int argc, char** argv) {
                 //nk_sdl_render(NK_ANTI_ALIASING_ON, MAX_VERTEX_BUFFER, MAX_ELEMENT_BUFFER);
         }
         //nk_sdl_shutdown();
+        obj_async_finish(&mesh_load);
+        if(mesh_uploading == TRUE) free_mesh_data(&mesh_upload.mesh);
         SDL_GL_DeleteContext(glContext);
         SDL_DestroyWindow(glWindow);
         SDL_Quit();